@@ -1,26 +1,62 @@
 #include <iostream>
 #include <cstdio>
+#include <set>
 #include <string>
 #include <algorithm>
 #include <cstdlib>
 #include <cstring>
 #include <dirent.h>
+#include <vector>
 #include "progress_bar.hpp"
+#include "archive_format.hpp"
+#include "bit_writer.hpp"
+#include "cli_options.hpp"
+#include "crc32c.hpp"
+#include "histogram.hpp"
+#include "huffman.hpp"
+#include "input_file.hpp"
+#include "io_uring_batch.hpp"
+#include "phase_timer.hpp"
+#include "pipeline.hpp"
+#include "stream_format.hpp"
+#include "trained_table.hpp"
 
 using namespace std;
 
 
 void write_from_uChar(unsigned char,unsigned char&,int,FILE*);
 
+struct folder_entry{         //an entry of a folder, in readdir order
+    string name;
+    bool folder;
+    bool small;             //read by the io_uring batches (see io_uring_batch.hpp)
+    size_t size;            //of small files, from statx
+};
+
+struct small_file_batch{    //contents of the next small files of a folder, read in one io_uring batch
+    vector<vector<unsigned char>> contents;
+    vector<int> results;
+    size_t first=0,count=0;     //entries [first, first+count) of the folder
+};
+
 int this_is_not_a_folder(char*);
-long int size_of_the_file(char*);
-void count_in_folder(string,long int*,long int&,long int&);
+void open_the_file(input_file&,const char*);
+DIR *list_the_folder(const string&,vector<folder_entry>&);
+void open_the_entry(input_file&,const string&,const vector<folder_entry>&,size_t,DIR*,small_file_batch&);
+void count_in_folder(string,long int*,long int&,long int&,const unsigned char*);
+void count_the_file(const input_file&,const string&,long int*,long int&,const unsigned char*);
 
+void write_varint(unsigned long int,unsigned char&,int,FILE*);
 void write_file_count(int,unsigned char&,int,FILE*);
-void write_file_size(long int,unsigned char&,int,FILE*);
-void write_file_name(char*,string*,unsigned char&,int&,FILE*);
-void write_the_file_content(FILE*,long int,string*,unsigned char&,int&,FILE*);
-void write_the_folder(string,string*,unsigned char&,int&,FILE*);
+void write_file_size(unsigned long int,unsigned char&,int,FILE*);
+void write_file_name(char*,code_table&,unsigned char&,int&,FILE*);
+void write_the_file_content(const input_file&,code_table&,unsigned char&,int&,FILE*);
+template<class Sink> void encode_the_content(const input_file&,code_table&,bit_writer<Sink>&,read_ahead*,unsigned long int);
+void write_stored_content(const input_file&,const char*,unsigned char&,int&,FILE*);
+void write_the_folder(string,code_table&,unsigned char&,int&,FILE*);
+void add_to_index(const string&,unsigned long int,int,int,FILE*);
+
+int compress_stream(FILE*,FILE*,int);
 
 
 
@@ -34,48 +70,61 @@ https://en.wikipedia.org/wiki/Huffman_coding#Basic_technique
 
 1-Size information
 2-Counting usage frequency of unique bytes and unique byte count
-3-Creating the base of the translation array
-4-Creating the translation tree inside the translation array by weight distribution
-5-adding strings from top to bottom to create translated versions of unique bytes
+3-4-5-Creating the translation tree by weight distribution and finding the transformation length
+      of every unique byte from its depth (huffman_code_lengths in code_table.hpp)
+6-limiting the lengths to MAX_CODE_LENGTH and creating canonical transformations from the lengths
 
 ---------PART 2-CREATION OF COMPRESSED FILE-----------
     Compressed File's structure had been documented below
 
-first (one byte)            ->  letter_count
+zeroth (5 bytes)            ->  FORMAT_MAGIC and FORMAT_VERSION (see archive_format.hpp)
+first (varint)              ->  letter_count
 second (bit group)
     2.1 (one byte)          ->  password_length
     2.2 (bytes)             ->  password (if password exists)
 third (bit groups)
     3.1 (8 bits)            ->  current unique byte
     3.2 (8 bits)            ->  length of the transformation
-    3.3 (bits)              ->  transformation code of that unique byte
+        (transformations are canonical, so they are rebuilt from the lengths: see code_table.hpp)
 
-fourth (2 bytes)**          ->  file_count (inside the current folder)
+fourth (varint)**           ->  file_count (inside the current folder)
     fifth (1 bit)*          ->  file or folder information  ->  folder(0) file(1)
-    sixth (8 bytes)         ->  size of current input_file (IF FILE)
+    sixth (varint)          ->  size of current input_file (IF FILE), with STORED_FILE set if the file is stored
     seventh (bit group)
-        7.1 (8 bits)        ->  length of current input_file's or folder's name
+        7.1 (varint)        ->  length of current input_file's or folder's name
         7.2 (bits)          ->  transformed version of current input_file's or folder's name
     eighth (a lot of bits)  ->  transformed version of current input_file (IF FILE)
+                                or for a stored file: zero bits up to the next byte boundary and the bytes of the file
 
 *whenever we see a new folder we will write seventh then start writing from fourth to eighth
 **groups from fifth to eighth will be written as much as file count in that folder
     (this is argument_count-1(argc-1) for the main folder)
+Files whose bytes are close to random (STORED_ENTROPY in histogram.hpp) are stored, see archive_format.hpp
+ninth (bytes)               ->  index: path, size, bit offset of the content and CRC32C of every CHECKSUM_BLOCK_SIZE bytes
+                                of every file and folder (see archive_format.hpp)
+Varints are written a byte at a time like the other bytes of the stream (see encode_varint in archive_format.hpp)
 
 */
 
 progress PROGRESS;
-
-struct ersel{   //this structure will be used to create the translation tree
-    ersel *left,*right;
-    long int number;
-    unsigned char character;
-    string bit;
+phase_timer PHASES;     //--timing, every part below enters its phase (see phase_timer.hpp)
+set<string> STORED_FILES;       //paths of the files that are stored instead of transformed, found while counting
+long int STORED_BYTES=0;
+vector<index_entry> INDEX;      //ninth part, filled while the records are written
+size_t SEEK_INTERVAL=0;         //--seek, input bytes between two seek points of a file (one every checksum block by default)
+io_uring_batch URING;           //--io-uring, not started without it or where io_uring is not available
+bool PIPELINE=false;            //--pipeline, large files are encoded between a reader and a writer thread (see pipeline.hpp)
+
+struct timed_file_sink{     //file_sink of bit_writer that counts the time of its fwrite calls as the write phase
+    FILE *fp;
+    void write(const unsigned char *p,size_t n){
+        PHASES.enter(PHASE_WRITE);
+        fwrite(p,1,n,fp);
+        PHASES.add_bytes(PHASE_WRITE,n);
+        PHASES.enter(PHASE_ENCODE);
+    }
 };
 
-bool erselcompare0(ersel a,ersel b){
-    return a.number<b.number;
-}
 
 
 
@@ -83,10 +132,28 @@ int main(int argc,char *argv[]){
     long int number[256];
     long int total_bits=0;
     int letter_count=0;
-    if(argc==1){
-        cout<<"Missing file name"<<endl<<"try './archive {{file_name}}'"<<endl;
+    cli_options options;
+    if(!parse_options(argc,argv,options)||(argc==1&&!options.stream)){
+        cout<<"Missing file name"<<endl<<"try './archive {{file_name}}'"<<endl
+            <<"or './archive --stream [--interleave[={{N}}]] < input > output' to compress a pipe"<<endl
+            <<"options: -p {{password}}, -n (no password), -y (do not ask to continue), -q (no progress bar), -b (-n -y -q), --timing[={{file}}] (JSON report of every phase)"<<endl
+            <<"         --train={{table_file}} (save a table trained on the files), --table={{text|csv|table_file}} (skip counting)"<<endl
+            <<"         --seek={{KB}} (seek point interval in the index for reading and verifying parts of files, default 1024),"<<endl
+            <<"         --io-uring (read the small files of folders in io_uring batches),"<<endl
+            <<"         --pipeline (read and write large files on their own threads, for cold caches and slow disks)"<<endl;
         return 0;
     }
+    if(options.stream){
+        return compress_stream(stdin,stdout,options.streams);
+    }
+    PROGRESS.enabled=PROGRESS.enabled&&options.show_progress;
+    PHASES.enabled=options.timing;
+    SEEK_INTERVAL=options.seek_interval;
+    PIPELINE=options.pipeline;
+    if(options.io_uring&&!URING.start()){
+        cout<<"io_uring is not available, files are read with POSIX calls"<<endl;
+    }
+    PHASES.enter(PHASE_WALK);
     for(long int *i=number;i<number+256;i++){                       
         *i=0;
     }
@@ -115,135 +182,89 @@ int main(int argc,char *argv[]){
             // after this code block, program checks the 'number' array
             //and writes the number of unique bytes count to 'letter_count' variable
 
-    unsigned char *x_p,x;                  //these are temp variables to take input from the file
-    x_p=&x;
+    unsigned char lengths[256]={0};
+    bool trained=!options.table.empty();     //--table: lengths come from a trained table (see trained_table.hpp), contents are only sampled
+    if(trained&&!options.train.empty()){
+        cout<<"--train and --table cannot be used together"<<endl<<"Process has been terminated"<<endl;
+        return 1;
+    }
+    if(trained&&!load_table(options.table,lengths)){
+        cout<<options.table<<" is not a translation table"<<endl<<"Process has been terminated"<<endl;
+        return 1;
+    }
+
     long int total_size=0,size;
-    total_bits+=16+9*(argc-1);
+    total_bits+=8*varint_size(argc-1)+(argc-1)+8*INDEX_TRAILER_SIZE;
+    vector<input_file> inputs(argc);        //input files given as arguments stay open (mapped) for both passes
     for(int current_file=1;current_file<argc;current_file++){
 
         for(char *c=argv[current_file];*c;c++){        //counting usage frequency of unique bytes on the file name (or folder name)
             number[(unsigned char)(*c)]++;
         }
+        total_bits+=8*(varint_size(strlen(argv[current_file]))+index_entry_size(strlen(argv[current_file])));
 
         if(this_is_not_a_folder(argv[current_file])){
-            total_size+=size=size_of_the_file(argv[current_file]);
-            total_bits+=64;
-
-            original_fp=fopen(argv[current_file],"rb");
-            fread(x_p,1,1,original_fp);
-            for(long int j=0;j<size;j++){    //counting usage frequency of unique bytes inside the file
-                number[x]++;
-                fread(x_p,1,1,original_fp);
-            }
-            fclose(original_fp);
+            PHASES.enter(PHASE_WALK);
+            open_the_file(inputs[current_file],argv[current_file]);
+            total_size+=inputs[current_file].size;
+            total_bits+=8*varint_size(inputs[current_file].size);
+
+            count_the_file(inputs[current_file],argv[current_file],number,total_bits,trained?lengths:NULL);     //counting usage frequency of unique bytes inside the file
 
         }
         else{
             string temp=argv[current_file];
-            count_in_folder(temp,number,total_size,total_bits);
+            count_in_folder(temp,number,total_size,total_bits,trained?lengths:NULL);
         }        
     }
 
 	for(long int *i=number;i<number+256;i++){                 
-        	if(*i){
+        	if(*i||lengths[i-number]){      //a trained table gives a length to every byte
 			letter_count++;
 			}
     }
+
+    if(!options.train.empty()){
+        // --train: the counts become a translation table that later runs can use with --table, nothing is compressed
+        train_table(number,lengths);
+        if(!save_table(options.train,lengths)){
+            cout<<options.train<<" could not be written"<<endl<<"Process has been terminated"<<endl;
+            return 1;
+        }
+        cout<<"Created translation table: "<<options.train<<endl;
+        return 0;
+    }
     //---------------------------------------------
 
 
 
-    //--------------------3------------------------
-        // creating the base of translation array(and then sorting them by ascending frequencies
-        // this array of type 'ersel' will not be used after calculating transformed versions of every unique byte
-        // instead its info will be written in a new string array called str_arr 
-    ersel array[letter_count*2-1];
-    ersel *e=array;
-    for(long int *i=number;i<number+256;i++){                         
-        	if(*i){
-                e->right=NULL;
-                e->left=NULL;
-                e->number=*i;
-                e->character=i-number;
-                e++;
-            }
+    //------------------3-4-5----------------------
+    PHASES.enter(PHASE_TREE);
+    long int counted_bytes=0;
+    for(long int *i=number;i<number+256;i++){
+        counted_bytes+=*i;
     }
-    sort(array,array+letter_count,erselcompare0);
-    //---------------------------------------------
-    
-                   
-    
-    //-------------------4-------------------------
-        // min1 and min2 represents nodes that has minimum weights
-        // isleaf is the pointer that traverses through leafs and
-        // notleaf is the pointer that traverses through nodes that are not leafs
-    ersel *min1=array,*min2=array+1,*current=array+letter_count,*notleaf=array+letter_count,*isleaf=array+2;            
-    for(int i=0;i<letter_count-1;i++){                           
-        current->number=min1->number+min2->number;
-        current->left=min1;
-        current->right=min2;
-        min1->bit="1";
-        min2->bit="0";     
-        current++;
-        
-        if(isleaf>=array+letter_count){
-            min1=notleaf;
-            notleaf++;
-        }
-        else{
-            if(isleaf->number<notleaf->number){
-                min1=isleaf;
-                isleaf++;
-            }
-            else{
-                min1=notleaf;
-                notleaf++;
-            }
-        }
-        
-        if(isleaf>=array+letter_count){
-            min2=notleaf;
-            notleaf++;
-        }
-        else if(notleaf>=current){
-            min2=isleaf;
-            isleaf++;
-        }
-        else{
-            if(isleaf->number<notleaf->number){
-                min2=isleaf;
-                isleaf++;
-            }
-            else{
-                min2=notleaf;
-                notleaf++;
-            }
-        }
-        
+    if(!trained){
+        huffman_code_lengths(number,lengths);
     }
-        // At every cycle, 2 of the least weighted nodes will be chosen to
-        // create a new node that has weight equal to sum of their weights combined.
-            // After we are done with these nodes they will become childrens of created nodes
-            // and they will be passed so that they wont be used in this process again.
+        // huffman_code_lengths (code_table.hpp) sorts the unique bytes by ascending frequencies and
+        // at every cycle merges 2 of the least weighted nodes into a new node that has weight equal to sum of their weights.
+            // The depth of every leaf in this tree is the length of the transformation that corresponds to it,
+            // so the most used character is using least number of bits.
+                // huffman_block.cpp and the parallel compressor call the same function, so their codes are the same
     //---------------------------------------------
 
 
-    
-    //-------------------5-------------------------
-    for(e=array+letter_count*2-2;e>array-1;e--){
-        if(e->left){
-            e->left->bit=e->bit+e->left->bit;
-        }
-        if(e->right){
-            e->right->bit=e->bit+e->right->bit;
-        }
-        
+
+    //-------------------6-------------------------
+    if(!trained){
+        limit_code_lengths(lengths,number,MAX_CODE_LENGTH);
     }
-        // In this block we are adding the bytes from root to leafs
-        // and after this is done every leaf will have a transformation string that corresponds to it
-            // Note: It is actually a very neat process. Using 4th and 5th code blocks, we are making sure that
-            // the most used character is using least number of bits.
-                // Specific number of bits we re going to use for that character is determined by weight distribution
+    code_table codes;
+    codes.assign_canonical(lengths);
+        // Very skewed inputs can create transformations that are longer than MAX_CODE_LENGTH,
+        // limit_code_lengths shortens them (this costs a little compression only on such inputs).
+        // Then every unique byte gets its canonical transformation, which only depends on the lengths
     //---------------------------------------------
 
 
@@ -257,26 +278,36 @@ int main(int argc,char *argv[]){
 
 
 
+    PHASES.enter(PHASE_HEADER);
     compressed_fp=fopen(&scompressed[0],"wb");
     int current_bit_count=0;
     unsigned char current_byte;
     //--------------writes first--------------
-    fwrite(&letter_count,1,1,compressed_fp);
-    total_bits+=8;
+    fwrite(FORMAT_MAGIC,1,sizeof(FORMAT_MAGIC),compressed_fp);
+    fputc(FORMAT_VERSION,compressed_fp);
+    unsigned char varint[MAX_VARINT_BYTES];
+    int varint_length=encode_varint(letter_count,varint);
+    fwrite(varint,1,varint_length,compressed_fp);
+    total_bits+=8*(sizeof(FORMAT_MAGIC)+1+varint_length);
     //----------------------------------------
 
 
 
     //--------------writes second-------------
     {
-        cout<<"If you want a password write any number other then 0"<<endl
-            <<"If you do not, write 0"<<endl;
-        int check_password;
-        cin>>check_password;
+        int check_password=options.has_password;
+        string password=options.password;
+        if(options.ask_password){       //questions are only asked when the command line did not answer them
+            PHASES.enter(PHASE_NONE);   //waiting for the user is not measured
+            cout<<"If you want a password write any number other then 0"<<endl
+                <<"If you do not, write 0"<<endl;
+            cin>>check_password;
+            if(check_password){
+                cout<<"Enter your password (Do not use whitespaces): ";
+                cin>>password;
+            }
+        }
         if(check_password){
-            string password;
-            cout<<"Enter your password (Do not use whitespaces): ";
-            cin>>password;
             int password_length=password.length();
             if(password_length==0){
                 cout<<"You did not enter a password"<<endl<<"Process has been terminated"<<endl;
@@ -314,59 +345,50 @@ int main(int argc,char *argv[]){
 
 
     //------------writes third---------------
-    char *str_pointer;
     unsigned char len,current_character;
-    string str_arr[256];
-    for(e=array;e<array+letter_count;e++){
-        str_arr[(e->character)]=e->bit;     //we are putting the transformation string to str_arr array to make the compression process more time efficient
-        len=e->bit.length();
-        current_character=e->character;
+    for(int c=0;c<256;c++){
+        if(!number[c]&&!lengths[c]){
+            continue;
+        }
+        len=codes.length[c];
+        current_character=c;
 
         write_from_uChar(current_character,current_byte,current_bit_count,compressed_fp);
         write_from_uChar(len,current_byte,current_bit_count,compressed_fp);
-        total_bits+=len+16;
+        total_bits+=16;
         // above lines will write the byte and the number of bits
         // we re going to need to represent this specific byte's transformated version
-        // after here we are going to write the transformed version of the number bit by bit.
-        
-        str_pointer=&e->bit[0];
-        while(*str_pointer){
-            if(current_bit_count==8){
-                fwrite(&current_byte,1,1,compressed_fp);
-                current_bit_count=0;
-            }
-            switch(*str_pointer){
-                case '1':current_byte<<=1;current_byte|=1;current_bit_count++;break;
-                case '0':current_byte<<=1;current_bit_count++;break;
-                default:cout<<"An error has occurred"<<endl<<"Compression process aborted"<<endl;
-                fclose(compressed_fp);
-                remove(&scompressed[0]);
-                return 1;
-            }
-           str_pointer++;
-        }
-        
-         total_bits+=len*(e->number);
+        // the transformation itself is not written, extractor rebuilds it from the lengths
+
+         total_bits+=len*number[c];
     }
     if(total_bits%8){
         total_bits=(total_bits/8+1)*8;        
         // from this point on total bits doesnt represent total bits
         // instead it represents 8*number_of_bytes we are gonna use on our compressed file
     }
-    // Above loop writes the translation script into compressed file and the str_arr array
+    // Above loop writes the translation script into compressed file
     //----------------------------------------
 
 
     cout<<"The size of the sum of ORIGINAL files is: "<<total_size<<" bytes"<<endl;
-    cout<<"The size of the COMPRESSED file will be: "<<total_bits/8<<" bytes"<<endl;
-    cout<<"Compressed file's size will be [%"<<100*((float)total_bits/8/total_size)<<"] of the original file"<<endl;
-    if(total_bits/8>total_size){
-        cout<<endl<<"COMPRESSED FILE'S SIZE WILL BE HIGHER THAN THE SUM OF ORIGINALS"<<endl<<endl;
-    }
-    cout<<"If you wish to abort this process write 0 and press enter"<<endl
-        <<"If you want to continue write any other number and press enter"<<endl;
-    int check;
-    cin>>check;
+    if(trained){        //the contents were not counted, so there is nothing to estimate from
+        cout<<"The size of the COMPRESSED file is not known before compression with a trained table"<<endl;
+    }
+    else{
+        cout<<"The size of the COMPRESSED file will be: "<<total_bits/8<<" bytes"<<endl;
+        cout<<"Compressed file's size will be [%"<<100*((float)total_bits/8/total_size)<<"] of the original file"<<endl;
+        if(total_bits/8>total_size){
+            cout<<endl<<"COMPRESSED FILE'S SIZE WILL BE HIGHER THAN THE SUM OF ORIGINALS"<<endl<<endl;
+        }
+    }
+    int check=1;
+    if(options.ask_confirmation){
+        PHASES.enter(PHASE_NONE);
+        cout<<"If you wish to abort this process write 0 and press enter"<<endl
+            <<"If you want to continue write any other number and press enter"<<endl;
+        cin>>check;
+    }
     if(!check){
         cout<<endl<<"Process has been aborted"<<endl;
         fclose(compressed_fp);
@@ -376,19 +398,19 @@ int main(int argc,char *argv[]){
 
 
 
-    PROGRESS.MAX=(array+letter_count*2-2)->number;      //setting progress bar
+    PROGRESS.MAX=trained?total_size:counted_bytes+STORED_BYTES;      //setting progress bar
 
     //-------------writes fourth---------------
+    PHASES.enter(PHASE_HEADER);
     write_file_count(argc-1,current_byte,current_bit_count,compressed_fp);
+    PHASES.add_bytes(PHASE_HEADER,ftell(compressed_fp));
     //---------------------------------------
 
     for(int current_file=1;current_file<argc;current_file++){
         
+        PHASES.enter(PHASE_ENCODE);
         if(this_is_not_a_folder(argv[current_file])){   //if current is a file and not a folder
-            original_fp=fopen(argv[current_file],"rb");
-            fseek(original_fp,0,SEEK_END);
-            size=ftell(original_fp);
-            rewind(original_fp);
+            size=inputs[current_file].size;
 
             //-------------writes fifth--------------
             if(current_bit_count==8){
@@ -400,10 +422,17 @@ int main(int argc,char *argv[]){
             current_bit_count++;
             //---------------------------------------
 
-            write_file_size(size,current_byte,current_bit_count,compressed_fp);             //writes sixth
-            write_file_name(argv[current_file],str_arr,current_byte,current_bit_count,compressed_fp);   //writes seventh
-            write_the_file_content(original_fp,size,str_arr,current_byte,current_bit_count,compressed_fp);      //writes eighth
-            fclose(original_fp);
+            bool stored=STORED_FILES.count(argv[current_file]);
+            write_file_size(stored?size|STORED_FILE:size,current_byte,current_bit_count,compressed_fp);             //writes sixth
+            write_file_name(argv[current_file],codes,current_byte,current_bit_count,compressed_fp);   //writes seventh
+            add_to_index(argv[current_file],size,stored?INDEX_STORED:0,current_bit_count,compressed_fp);
+            if(stored){
+                write_stored_content(inputs[current_file],argv[current_file],current_byte,current_bit_count,compressed_fp);   //writes eighth
+            }
+            else{
+                write_the_file_content(inputs[current_file],codes,current_byte,current_bit_count,compressed_fp);      //writes eighth
+            }
+            inputs[current_file].release();
         }
         else{   //if current is a folder instead
 
@@ -416,10 +445,11 @@ int main(int argc,char *argv[]){
             current_bit_count++;
             //---------------------------------------
 
-            write_file_name(argv[current_file],str_arr,current_byte,current_bit_count,compressed_fp);   //writes seventh
+            write_file_name(argv[current_file],codes,current_byte,current_bit_count,compressed_fp);   //writes seventh
+            add_to_index(argv[current_file],0,INDEX_FOLDER,current_bit_count,compressed_fp);
 
             string folder_name=argv[current_file];
-            write_the_folder(folder_name,str_arr,current_byte,current_bit_count,compressed_fp);
+            write_the_folder(folder_name,codes,current_byte,current_bit_count,compressed_fp);
         }
     }
 
@@ -427,17 +457,29 @@ int main(int argc,char *argv[]){
 
 
 
+    PHASES.enter(PHASE_WRITE);
     if(current_bit_count==8){      // here we are writing the last byte of the file
         fwrite(&current_byte,1,1,compressed_fp);
     }
-    else{
+    else if(current_bit_count){     // bit_writer may leave the last byte already written
         current_byte<<=8-current_bit_count;
         fwrite(&current_byte,1,1,compressed_fp);
     }
+    write_index(compressed_fp,INDEX);      //writes ninth
 
-    fclose(compressed_fp);
-    system("clear");
+    long int compressed_size=ftell(compressed_fp);
+    if(ferror(compressed_fp)|fclose(compressed_fp)){       //e.g. the disk is full
+        cout<<endl<<"The compressed file could not be written"<<endl<<"Process has been aborted"<<endl;
+        exit(1);
+    }
+    PROGRESS.finish();
+    if(options.timing&&!PHASES.report("archive",1,PHASES.bytes[PHASE_HISTOGRAM],compressed_size,options.timing_file)){
+        cout<<options.timing_file<<" could not be written"<<endl;
+    }
     cout<<endl<<"Created compressed file: "<<scompressed<<endl;
+    if(trained){
+        cout<<"The size of the COMPRESSED file is: "<<compressed_size<<" bytes"<<endl;
+    }
     cout<<"Compression is complete"<<endl;
     
 }
@@ -456,76 +498,129 @@ void write_from_uChar(unsigned char uChar,unsigned char &current_byte,int curren
 
 
 
-//below function is writing number of files we re going to translate inside current folder to compressed file's 2 bytes
+//below function writes a count or a length as a varint (see encode_varint in archive_format.hpp), 7 bits per byte
     //It is done like this to make sure that it can work on little, big or middle-endian systems
+void write_varint(unsigned long int value,unsigned char &current_byte,int current_bit_count,FILE *compressed_fp){
+    unsigned char bytes[MAX_VARINT_BYTES];
+    int length=encode_varint(value,bytes);
+    for(int i=0;i<length;i++){
+        write_from_uChar(bytes[i],current_byte,current_bit_count,compressed_fp);
+    }
+}
+
+
+
+//below function is writing number of files we re going to translate inside current folder to compressed file
 void write_file_count(int file_count,unsigned char &current_byte,int current_bit_count,FILE *compressed_fp){
-    unsigned char temp=file_count%256;
-    write_from_uChar(temp,current_byte,current_bit_count,compressed_fp);
-    temp=file_count/256;
-    write_from_uChar(temp,current_byte,current_bit_count,compressed_fp);
+    write_varint(file_count,current_byte,current_bit_count,compressed_fp);
 }
 
 
 
-//This function is writing byte count of current input file to compressed file using 8 bytes
-    //It is done like this to make sure that it can work on little, big or middle-endian systems
-void write_file_size(long int size,unsigned char &current_byte,int current_bit_count,FILE *compressed_fp){
-    PROGRESS.next(size);        //updating progress bar
-    for(int i=0;i<8;i++){
-        write_from_uChar(size%256,current_byte,current_bit_count,compressed_fp);
-        size/=256;
-    }
+//This function is writing byte count of current input file to compressed file (STORED_FILE makes it 10 bytes long)
+void write_file_size(unsigned long int size,unsigned char &current_byte,int current_bit_count,FILE *compressed_fp){
+    write_varint(size,current_byte,current_bit_count,compressed_fp);
 }
 
 
 
 // This function writes bytes that are translated from current input file's name to the compressed file.
-void write_file_name(char *file_name,string *str_arr,unsigned char &current_byte,int &current_bit_count,FILE *compressed_fp){
-    write_from_uChar(strlen(file_name),current_byte,current_bit_count,compressed_fp);
-    char *str_pointer;
-    for(char *c=file_name;*c;c++){
-        str_pointer=&str_arr[(unsigned char)(*c)][0];
-        while(*str_pointer){
-            if(current_bit_count==8){
-                fwrite(&current_byte,1,1,compressed_fp);
-                current_bit_count=0;
-            }
-            switch(*str_pointer){
-                case '1':current_byte<<=1;current_byte|=1;current_bit_count++;break;
-                case '0':current_byte<<=1;current_bit_count++;break;
-                default:cout<<"An error has occurred"<<endl<<"Process has been aborted";
-                exit(2);
-            }
-            str_pointer++;
-        }
-    }
+void write_file_name(char *file_name,code_table &codes,unsigned char &current_byte,int &current_bit_count,FILE *compressed_fp){
+    write_varint(strlen(file_name),current_byte,current_bit_count,compressed_fp);
+    bit_writer<file_sink> writer(file_sink{compressed_fp},current_byte,current_bit_count,64);
+    writer.encode((unsigned char*)file_name,strlen(file_name),codes);
+    writer.finish(current_byte,current_bit_count);
 }
 
 
 
 // Below function translates and writes bytes from current input file to the compressed file.
-void write_the_file_content(FILE *original_fp,long int size,string *str_arr,unsigned char &current_byte,int &current_bit_count,FILE *compressed_fp){
-    unsigned char *x_p,x;
-    x_p=&x;
-    char *str_pointer;
-    fread(x_p,1,1,original_fp);
-    for(long int i=0;i<size;i++){
-        str_pointer=&str_arr[x][0];
-        while(*str_pointer){
-            if(current_bit_count==8){
-                fwrite(&current_byte,1,1,compressed_fp);
-                current_bit_count=0;
-            }
-            switch(*str_pointer){
-                case '1':current_byte<<=1;current_byte|=1;current_bit_count++;break;
-                case '0':current_byte<<=1;current_bit_count++;break;
-                default:cout<<"An error has occurred"<<endl<<"Process has been aborted";
-                exit(2);
-            }
-            str_pointer++;
+    // The bytes come straight from the mapping of the file and every byte is turned into its code word
+    // with a single table lookup, bit_writer packs the code words into 64-bit words before they reach the compressed file
+    // with --pipeline, files larger than one block go through the pipeline of pipeline.hpp: a reader thread faults the
+    // next blocks of the mapping in and a writer thread writes the full output blocks while this thread keeps encoding
+void write_the_file_content(const input_file &input,code_table &codes,unsigned char &current_byte,int &current_bit_count,FILE *compressed_fp){
+    const unsigned long int start=ftell(compressed_fp)*8;      //first bit of the byte the writer starts in
+    INDEX.back().seek_interval=SEEK_INTERVAL;
+    PHASES.add_bytes(PHASE_ENCODE,input.size);
+    if(!PIPELINE||input.size<=PIPELINE_BLOCK){       //nothing to overlap
+        bit_writer<timed_file_sink> writer(timed_file_sink{compressed_fp},current_byte,current_bit_count);
+        encode_the_content(input,codes,writer,NULL,start);
+        writer.finish(current_byte,current_bit_count);
+        return;
+    }
+    write_behind output(compressed_fp,PHASES.enabled);
+    read_ahead reader(input);
+    bit_writer<write_behind_sink> writer(write_behind_sink{&output},current_byte,current_bit_count);
+    encode_the_content(input,codes,writer,&reader,start);
+    writer.finish(current_byte,current_bit_count);
+    if(!output.finish()){
+        cout<<"The compressed file could not be written"<<endl<<"Process has been aborted"<<endl;
+        exit(1);
+    }
+    PHASES.add_bytes(PHASE_WRITE,output.written);
+    PHASES.add_thread_time(output.clock,PHASE_ENCODE);      //the writer thread wrote while this thread encoded
+}
+
+// Encoder of write_the_file_content
+    // the file is encoded in 1MB steps so the progress bar moves inside large files too
+    // the steps also stop at every seek point (--seek), where the bit position goes to the index entry of the file
+    // steps never cross a checksum block, so the checksum of a block is taken right before it is encoded
+    // with a reader, the block is in memory before the checksum is taken
+template<class Sink> void encode_the_content(const input_file &input,code_table &codes,bit_writer<Sink> &writer,read_ahead *reader,unsigned long int start){
+    const size_t step=1024*1024;
+    index_entry &entry=INDEX.back();
+    for(size_t done=0,length;done<input.size;done+=length){
+        length=min(step,input.size-done);
+        if(SEEK_INTERVAL)length=min(length,SEEK_INTERVAL-done%SEEK_INTERVAL);
+        length=min(length,CHECKSUM_BLOCK_SIZE-done%CHECKSUM_BLOCK_SIZE);
+        const size_t block_end=min(input.size,(done/CHECKSUM_BLOCK_SIZE+1)*CHECKSUM_BLOCK_SIZE);
+        if(reader)reader->wait(block_end);
+        if(done%CHECKSUM_BLOCK_SIZE==0){
+            entry.checksums.push_back(crc32c(input.data+done,block_end-done));
         }
-        fread(x_p,1,1,original_fp);
+        writer.encode(input.data+done,length,codes);
+        PROGRESS.add(length);       //updating progress bar
+        if(SEEK_INTERVAL&&(done+length)%SEEK_INTERVAL==0&&done+length<input.size){
+            entry.seek_points.push_back(start+writer.bits());
+        }
+    }
+}
+
+// Stored files skip the translation: the pending bits are padded to a whole byte
+    // and the bytes of the file are copied to the compressed file by the kernel (see copy_input in input_file.hpp)
+    // the checksums of the blocks are taken from the mapping
+void write_stored_content(const input_file &input,const char *path,unsigned char &current_byte,int &current_bit_count,FILE *compressed_fp){
+    PHASES.enter(PHASE_WRITE);
+    if(current_bit_count){
+        current_byte<<=8-current_bit_count;
+        fwrite(&current_byte,1,1,compressed_fp);
+        current_bit_count=0;
+    }
+    for(size_t done=0;done<input.size;done+=CHECKSUM_BLOCK_SIZE){
+        INDEX.back().checksums.push_back(crc32c(input.data+done,min(CHECKSUM_BLOCK_SIZE,input.size-done)));
+    }
+    if(!copy_input(input,path,compressed_fp)){
+        cout<<"An error has occurred"<<endl<<"Process has been aborted"<<endl;
+        exit(1);
+    }
+    PHASES.add_bytes(PHASE_WRITE,input.size);
+    PROGRESS.add(input.size);
+    PHASES.enter(PHASE_ENCODE);
+}
+
+// Remembers the index entry of a file or folder, called right after its name is written:
+    // the content starts at the current bit of the compressed file, or at the next byte boundary if it is stored
+void add_to_index(const string &path,unsigned long int size,int flags,int current_bit_count,FILE *compressed_fp){
+    index_entry entry;
+    entry.path=path;
+    entry.size=size;
+    entry.flags=flags;
+    if(!(flags&INDEX_FOLDER)){
+        entry.offset=ftell(compressed_fp)*8+current_bit_count;
+        if(flags&INDEX_STORED)entry.offset=(entry.offset+7)/8*8;
     }
+    INDEX.push_back(entry);
 }
 
 int this_is_not_a_folder(char *path){
@@ -537,102 +632,185 @@ int this_is_not_a_folder(char *path){
     return 1;
 }
 
-long int size_of_the_file(char *path){
-    long int size;
-    FILE *fp=fopen(path,"rb");
-    fseek(fp,0,SEEK_END);
-    size=ftell(fp);
-    fclose(fp);
-    return size;
+// Below function opens an input file for both passes (see input_file.hpp)
+    // program can not continue without the file so it is terminated if the file can not be read
+void open_the_file(input_file &input,const char *path){
+    if(!input.open(path)){
+        cout<<path<<" file could not be read"<<endl<<"Process has been terminated"<<endl;
+        exit(1);
+    }
+}
+
+
+
+// This function counts usage frequency of bytes inside one file
+    // a file that is close to random (see STORED_ENTROPY in histogram.hpp) will be stored, so its bytes are not added to number
+    // and its path is remembered for the second pass
+    // with a trained table (not NULL) nothing is added to number, only samples of the file are counted to find out
+    // whether the table makes it smaller (see stored_with_table in trained_table.hpp)
+void count_the_file(const input_file &input,const string &path,long int *number,long int &total_bits,const unsigned char *table){
+    PHASES.enter(PHASE_HISTOGRAM);
+    long int file_number[256]={0};
+    bool stored;
+    if(table){
+        stored=stored_with_table(input.data,input.size,table);
+    }
+    else{
+        count_bytes(input.data,input.size,file_number);
+        PHASES.add_bytes(PHASE_HISTOGRAM,input.size);
+        stored=bits_per_byte(file_number)>=STORED_ENTROPY;
+    }
+    if(stored){
+        STORED_FILES.insert(path);
+        STORED_BYTES+=input.size;
+        total_bits+=8*input.size+8;     //the bytes and at most 8 bits of padding
+        return;
+    }
+    for(int c=0;c<256;c++){
+        number[c]+=file_number[c];
+    }
 }
 
 
 
 // This function counts usage frequency of bytes inside a folder
     // only give folder path as input
-void count_in_folder(string path,long int *number,long int &total_size,long int &total_bits){
-    FILE *original_fp;
+void count_in_folder(string path,long int *number,long int &total_size,long int &total_bits,const unsigned char *table){
+    PHASES.enter(PHASE_WALK);
+    input_file input;
     path+='/';
-    DIR *dir=opendir(&path[0]),*next_dir;
+    vector<folder_entry> entries;
+    small_file_batch batch;
+    DIR *dir=list_the_folder(path,entries);
     string next_path;
     total_size+=4096;
-    total_bits+=16; //for file_count
-    struct dirent *current;
-    while((current=readdir(dir))){
-        if(current->d_name[0]=='.'){
-            if(current->d_name[1]==0)continue;
-            if(current->d_name[1]=='.'&&current->d_name[2]==0)continue;
-        }
-        total_bits+=9;
+    for(size_t k=0;k<entries.size();k++){
+        const string &name=entries[k].name;
+        total_bits+=1+8*varint_size(name.size());
 
-        for(char *c=current->d_name;*c;c++){        //counting usage frequency of bytes on the file name (or folder name)
-            number[(unsigned char)(*c)]++;
+        for(unsigned char c:name){        //counting usage frequency of bytes on the file name (or folder name)
+            number[c]++;
         }
 
-        next_path=path+current->d_name;
+        next_path=path+name;
+        total_bits+=8*index_entry_size(next_path.size());
 
-        if((next_dir=opendir(&next_path[0]))){
-            closedir(next_dir);
-            count_in_folder(next_path,number,total_size,total_bits);
+        if(entries[k].folder){
+            count_in_folder(next_path,number,total_size,total_bits,table);
         }
         else{
-            long int size;
-            unsigned char *x_p,x;
-            x_p=&x;
-            total_size+=size=size_of_the_file(&next_path[0]);
-            total_bits+=64;
+            open_the_entry(input,next_path,entries,k,dir,batch);
+            total_size+=input.size;
+            total_bits+=8*varint_size(input.size);
 
             //--------------------2------------------------
-            original_fp=fopen(&next_path[0],"rb");
-
-            fread(x_p,1,1,original_fp);
-            for(long int j=0;j<size;j++){    //counting usage frequency of bytes inside the file
-                number[x]++;
-                fread(x_p,1,1,original_fp);
-            }
-            fclose(original_fp);
+            count_the_file(input,next_path,number,total_bits,table);     //counting usage frequency of bytes inside the file
+            PHASES.enter(PHASE_WALK);
+            input.release();
         }
     }
     closedir(dir);
+    total_bits+=8*varint_size(entries.size());
 }
 
 
 
-
-
-
-
-void write_the_folder(string path,string *str_arr,unsigned char &current_byte,int &current_bit_count,FILE *compressed_fp){
-    FILE *original_fp;
-    path+='/';
-    DIR *dir=opendir(&path[0]),*next_dir;
-    string next_path;
+// Lists the entries of a folder in readdir order, the folder stays open for open_the_entry
+    // the type of every entry comes from one fstatat each (which follows symbolic links like opendir does),
+    // with --io-uring from statx calls in batches, which also tell the small files apart
+    // an entry that cannot be stat'ed is taken as a file, opening it gives the error
+DIR *list_the_folder(const string &path,vector<folder_entry> &entries){
+    DIR *dir=opendir(&path[0]);
+    if(!dir){
+        cout<<path<<" folder could not be read"<<endl<<"Process has been terminated"<<endl;
+        exit(1);
+    }
     struct dirent *current;
-    int file_count=0;
-    long int size;
+    vector<string> names;
     while((current=readdir(dir))){
         if(current->d_name[0]=='.'){
             if(current->d_name[1]==0)continue;
             if(current->d_name[1]=='.'&&current->d_name[2]==0)continue;
         }
-        file_count++;
+        names.push_back(current->d_name);
+    }
+    entries.resize(names.size());
+    vector<name_status> status;
+    bool batched=URING.started()&&URING.stat_names(dirfd(dir),names,status);
+    for(size_t k=0;k<names.size();k++){
+        entries[k].name.swap(names[k]);
+        entries[k].small=false;
+        if(batched){
+            entries[k].folder=!status[k].error&&S_ISDIR(status[k].mode);
+            entries[k].small=!status[k].error&&S_ISREG(status[k].mode)&&status[k].size<=SMALL_FILE_SIZE;
+            entries[k].size=status[k].size;
+            continue;
+        }
+        struct stat st;
+        entries[k].folder=!fstatat(dirfd(dir),entries[k].name.c_str(),&st,0)&&S_ISDIR(st.st_mode);
     }
-    rewinddir(dir);
-    write_file_count(file_count,current_byte,current_bit_count,compressed_fp);  //writes fourth
+    return dir;
+}
 
-    while((current=readdir(dir))){  //if current is a file
-        if(current->d_name[0]=='.'){
-            if(current->d_name[1]==0)continue;
-            if(current->d_name[1]=='.'&&current->d_name[2]==0)continue;
+// Opens entry k of a folder for one pass
+    // small files are read together with the small files right after them in one io_uring batch,
+    // the others are opened like the arguments (see open_the_file)
+void open_the_entry(input_file &input,const string &path,const vector<folder_entry> &entries,size_t k,DIR *dir,small_file_batch &batch){
+    if(!entries[k].small){
+        open_the_file(input,&path[0]);
+        return;
+    }
+    if(k<batch.first||k>=batch.first+batch.count){
+        vector<const char*> names;
+        vector<size_t> sizes;
+        for(size_t j=k;j<entries.size()&&entries[j].small&&names.size()<BATCH_FILES;j++){
+            names.push_back(entries[j].name.c_str());
+            sizes.push_back(entries[j].size);
         }
+        batch.first=k;
+        batch.count=0;
+        if(!URING.read_files(dirfd(dir),names,sizes,batch.contents)){
+            open_the_file(input,&path[0]);
+            return;
+        }
+        batch.count=names.size();
+        batch.results.swap(URING.results);
+    }
+    size_t i=k-batch.first;
+    if(batch.results[i]<0){
+        cout<<path<<" file could not be read"<<endl<<"Process has been terminated"<<endl;
+        exit(1);
+    }
+    input.adopt(batch.contents[i]);
+}
+
 
-        next_path=path+current->d_name;
-        if(this_is_not_a_folder(&next_path[0])){
 
-            original_fp=fopen(&next_path[0],"rb");
-            fseek(original_fp,0,SEEK_END);
-            size=ftell(original_fp);
-            rewind(original_fp);
+
+
+
+
+void write_the_folder(string path,code_table &codes,unsigned char &current_byte,int &current_bit_count,FILE *compressed_fp){
+    PHASES.enter(PHASE_WALK);
+    input_file input;
+    path+='/';
+    vector<folder_entry> entries;
+    small_file_batch batch;
+    DIR *dir=list_the_folder(path,entries);
+    string next_path;
+    long int size;
+    PHASES.enter(PHASE_ENCODE);
+    write_file_count(entries.size(),current_byte,current_bit_count,compressed_fp);  //writes fourth
+
+    for(size_t k=0;k<entries.size();k++){
+        char *name=&entries[k].name[0];
+        next_path=path+name;
+        if(!entries[k].folder){     //if current is a file
+
+            PHASES.enter(PHASE_WALK);
+            open_the_entry(input,next_path,entries,k,dir,batch);
+            size=input.size;
+            PHASES.enter(PHASE_ENCODE);
 
             //-------------writes fifth--------------
             if(current_bit_count==8){
@@ -644,10 +822,17 @@ void write_the_folder(string path,string *str_arr,unsigned char &current_byte,in
             current_bit_count++;
             //---------------------------------------
 
-            write_file_size(size,current_byte,current_bit_count,compressed_fp);                     //writes sixth
-            write_file_name(current->d_name,str_arr,current_byte,current_bit_count,compressed_fp);                //writes seventh
-            write_the_file_content(original_fp,size,str_arr,current_byte,current_bit_count,compressed_fp);      //writes eighth
-            fclose(original_fp);
+            bool stored=STORED_FILES.count(next_path);
+            write_file_size(stored?size|STORED_FILE:size,current_byte,current_bit_count,compressed_fp);                     //writes sixth
+            write_file_name(name,codes,current_byte,current_bit_count,compressed_fp);                //writes seventh
+            add_to_index(next_path,size,stored?INDEX_STORED:0,current_bit_count,compressed_fp);
+            if(stored){
+                write_stored_content(input,&next_path[0],current_byte,current_bit_count,compressed_fp);      //writes eighth
+            }
+            else{
+                write_the_file_content(input,codes,current_byte,current_bit_count,compressed_fp);      //writes eighth
+            }
+            input.release();
         }
         else{   // if current is a folder
 
@@ -660,12 +845,36 @@ void write_the_folder(string path,string *str_arr,unsigned char &current_byte,in
             current_bit_count++;
             //---------------------------------------
 
-            write_file_name(current->d_name,str_arr,current_byte,current_bit_count,compressed_fp);   //writes seventh
+            write_file_name(name,codes,current_byte,current_bit_count,compressed_fp);   //writes seventh
+            add_to_index(next_path,0,INDEX_FOLDER,current_bit_count,compressed_fp);
 
-            write_the_folder(next_path,str_arr,current_byte,current_bit_count,compressed_fp);
+            write_the_folder(next_path,codes,current_byte,current_bit_count,compressed_fp);
+            PHASES.enter(PHASE_ENCODE);
         }
     }
     closedir(dir);
 
 
-}
\ No newline at end of file
+}
+
+
+
+// Streaming mode: compresses 'in' to 'out' block by block (layout is documented in stream_format.hpp)
+    // Every block is read once, counted, given its own translation table and written right away,
+    // so the input can be a pipe and memory use stays at about 3 blocks whatever the input size is
+int compress_stream(FILE *in,FILE *out,int streams){
+    vector<unsigned char> block(STREAM_BLOCK_SIZE),encoded;
+    size_t size;
+    while((size=fread(block.data(),1,block.size(),in))>0){
+        encoded.clear();
+        huffman::encode_block(block.data(),size,encoded,streams);       //same block codec as libhuffman
+        fwrite(encoded.data(),1,encoded.size(),out);
+    }
+    write_uint32(out,0);
+    fflush(out);
+    if(ferror(in)||ferror(out)){
+        cerr<<"An error has occurred"<<endl<<"Process has been aborted"<<endl;
+        return 1;
+    }
+    return 0;
+}
@@ -1,245 +1,437 @@
+#include "archive_format.hpp"
+#include "bit_writer.hpp"
+#include "cli_options.hpp"
+#include "crc32c.hpp"
+#include "histogram.hpp"
+#include "input_file.hpp"
+#include "phase_timer.hpp"
 #include "progress_bar.hpp"
+#include "task_pool.hpp"
+#include "trained_table.hpp"
 
 #include <algorithm>
+#include <atomic>
+#include <condition_variable>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
 #include <dirent.h>
+#include <fcntl.h>
 #include <iostream>
+#include <memory>
+#include <mutex>
 #include <omp.h>
 #include <string>
+#include <sys/stat.h>
+#include <thread>
 #include <vector>
 
 using namespace std;
 
 // Function declarations for file I/O operations
 void write_from_uChar(unsigned char, unsigned char&, int&, FILE*);
-void write_from_uChar(unsigned char, unsigned char&, int&, vector<unsigned char>&);
+void write_bit(int, unsigned char&, int&, FILE*);
+
+// Mapping of a file inside a folder that several tasks of one pass read (the byte ranges of a large file, its
+// chunks): the first task maps it, the others get the same mapping, and the last one to finish unmaps it
+struct file_mapping {
+    once_flag         opened;
+    input_file        input;
+    atomic<long int>  users;   // tasks of the pass that have not finished with the mapping
+    explicit file_mapping(long int count) : users(count) {}
+};
 
-// Utility functions for file and folder operations
-int      this_is_not_a_folder(char*);
-long int size_of_the_file(char*);
-void     count_in_folder(string, long int*, long int&, long int&);
+// Everything that is archived: an argument, or a file or folder found inside a folder argument.
+// The tree is walked once in parallel and flattened in the order of the records in the compressed file
+// (a folder record is followed by the records of its entries), which is the order both passes use
+struct tree_node {
+    string            path;   // path to open
+    string            name;   // name written to the compressed file (the argument itself for arguments)
+    bool              folder = false;
+    long int          size   = 0;      // files only
+    bool              stored = false;   // files that are stored instead of transformed (see archive_format.hpp)
+    uint64_t          offset = 0;       // bit offset of the content in the compressed file, for the index
+    vector<uint64_t>  seek_points;      // --seek, bit offsets of the seek points of the content
+    vector<uint32_t>  checksums;        // CRC32C of every CHECKSUM_BLOCK_SIZE bytes of the content
+    const input_file*        input  = NULL;   // arguments stay open for both passes, files inside folders are opened by the task that reads them
+    shared_ptr<file_mapping> mapping;         // files inside folders that several tasks of the current pass read
+    vector<tree_node>        children;        // folders only, in readdir order
+};
 
-// File writing operations
-void write_file_count(int, unsigned char&, int&, FILE*);
-void write_file_size(long int, unsigned char&, int&, vector<unsigned char>&);
-void write_file_name(char*, string*, unsigned char&, int&, vector<unsigned char>&);
-void write_the_file_content(FILE*, long int, string*, unsigned char&, int&, vector<unsigned char>&);
-void write_the_folder(string, string*, unsigned char&, int&, vector<unsigned char>&);
-
-progress PROGRESS;
-
-// Node structure for Huffman tree construction
-struct ersel {
-    ersel *       left, *right;
-    long int      number;      // Frequency count
-    unsigned char character;   // The byte value
-    string        bit;         // Huffman code
+// Contents of a file as one task sees them (see map_file), the shared mapping is given back when the task is done
+struct file_use {
+    input_file    own;
+    file_mapping* shared = NULL;
+    file_use() {}
+    file_use(const file_use&) = delete;
+    file_use& operator=(const file_use&) = delete;
+    ~file_use() {
+        if (shared && --shared->users == 0) shared->input.release();
+    }
 };
 
-// Comparison function for sorting nodes by frequency
-bool erselcompare0(ersel a, ersel b) {
-    return a.number < b.number;
-}
+void walk_folder(tree_node&, task_pool&);
+void flatten(tree_node&, vector<tree_node*>&);
+void open_the_file(input_file&, const char*);
+const input_file& map_file(const tree_node&, file_use&);
+void              share_mapping(tree_node&, long int);
+
+// Byte range of a file counted by one task of the first pass
+struct count_range {
+    long int record;
+    long int offset;
+    long int length;
+    long int histogram;   // shared histogram of a file of several ranges, -1 if the range is the whole file
+};
 
-// Recursively assign binary codes to the Huffman tree nodes
-void assign_codes(ersel* node, const string& code) {
-    if (!node) return;
-    node->bit = code;
-    assign_codes(node->left, code + "1");
-    assign_codes(node->right, code + "0");
-}
+const long int COUNT_RANGE_SIZE = 8 * 1024 * 1024;   // input bytes counted by one task, a multiple of CHUNK_SIZE
+
+// Bitstream of one chunk of a file, packed from the first bit of bytes
+struct encoded_chunk {
+    vector<unsigned char> bytes;
+    long int              bits = 0;
+    vector<long int>      seek_points;   // bits before every seek point inside the chunk (--seek)
+    uint32_t              checksum = 0;   // CRC32C of the input bytes, a chunk is one checksum block
+};
+
+// Parallel encoding of the whole tree: every record header and every CHUNK_SIZE piece of file content is a task,
+// so small files and large ones spread over all threads alike
+const long int CHUNK_SIZE   = CHECKSUM_BLOCK_SIZE;   // input bytes encoded by one task, one checksum block of the index
+const size_t   OUTPUT_FLUSH = 1024 * 1024;           // bytes the writer thread collects before an fwrite
+
+// Part of a record encoded by one task: the header of the record, a chunk of the file content,
+// or the whole content of a stored file, whose task only takes the checksums and which the writer thread copies
+struct piece {
+    long int record;
+    long int offset;   // in the file, or HEADER_PIECE or STORED_PIECE
+    long int length;
+};
+
+const long int HEADER_PIECE = -1;
+const long int STORED_PIECE = -2;
+
+// Bounded ring of output slots between the encoding threads and the writer thread. Piece i is encoded into
+// slot i % size once the writer is done with piece i - size, and the writer takes the pieces in order as soon as
+// they are published, so at most size encoded pieces are in memory and writing overlaps with encoding.
+// Pieces are handed out in increasing order, so the piece a slot waits for is always being encoded by another thread
+struct output_ring {
+    vector<encoded_chunk>   slots;
+    vector<long int>        ready;         // piece in every slot, once it is encoded
+    long int                written = 0;   // pieces the writer is done with
+    mutex                   lock;
+    condition_variable      slot_free, piece_ready;
+
+    explicit output_ring(long int size) : slots(size), ready(size, -1) {}
+
+    // encoding threads
+    encoded_chunk& acquire(long int i) {
+        unique_lock<mutex> guard(lock);
+        slot_free.wait(guard, [&] { return written > i - (long int)slots.size(); });
+        return slots[i % slots.size()];
+    }
+    void publish(long int i) {
+        {
+            lock_guard<mutex> guard(lock);
+            ready[i % slots.size()] = i;
+        }
+        piece_ready.notify_one();
+    }
+
+    // writer thread
+    const encoded_chunk& next(long int i) {
+        unique_lock<mutex> guard(lock);
+        piece_ready.wait(guard, [&] { return ready[i % slots.size()] == i; });
+        return slots[i % slots.size()];
+    }
+    void release(long int i) {
+        {
+            lock_guard<mutex> guard(lock);
+            written = i + 1;
+        }
+        slot_free.notify_all();
+    }
+};
+
+void encode_header(const tree_node&, code_table&, encoded_chunk&, int);
+void checksum_stored(tree_node&, const input_file&);
+void write_stored_content(const tree_node&, unsigned char&, int&, FILE*);
+void encode_chunk(const unsigned char*, long int, long int, long int, code_table&, encoded_chunk&, int);
+void append_chunk(const encoded_chunk&, unsigned char&, int&, vector<unsigned char>&);
+void write_pieces(const vector<piece>&, const vector<tree_node*>&, output_ring&, unsigned char&, int&, FILE*, thread_clock&);
+long int header_bits(const tree_node&, const code_table&);
+void write_pieces_at(const vector<piece>&, const vector<tree_node*>&, const vector<uint32_t>&, const vector<long int>&, long int,
+                     code_table&, unsigned char&, int&, FILE*, task_pool&);
+
+// File writing operations
+void write_file_count(int, unsigned char&, int&, FILE*);
+void put_varint(bit_writer<vector_sink>&, uint64_t);
+
+progress    PROGRESS;
+phase_timer PHASES;   // --timing (see phase_timer.hpp)
 
 int main(int argc, char* argv[]) {
     long int number[256]  = {0};   // Array to store byte frequencies
     long int total_bits   = 0;     // Total bits in compressed output
     int      letter_count = 0;     // Number of unique bytes
 
-    // Input validation
-    if (argc == 1) {
-        cout << "Missing file name" << endl << "try './archive {{file_name}}'" << endl;
+    // Options (see cli_options.hpp) and input validation
+    cli_options options;
+    const bool  options_ok = parse_options(argc, argv, options);
+    if (options_ok && options.stream) {   // the stream codec is in libhuffman, which only the serial compressor links
+        cout << "--stream is not supported by modified_archive" << endl
+             << "try './archive --stream [--interleave[={{N}}]] < input > output' to compress a pipe" << endl
+             << "Process has been terminated" << endl;
+        return 1;
+    }
+    if (!options_ok || argc == 1) {
+        cout << "Missing file name" << endl
+             << "try './modified_archive {{file_name}}'" << endl
+             << "or './archive --stream [--interleave[={{N}}]] < input > output' to compress a pipe" << endl
+             << "options: -p {{password}}, -n (no password), -y (do not ask to continue), -q (no progress bar), -b (-n -y -q),"
+             << " --timing[={{file}}] (JSON report of every phase)," << endl
+             << "         --train={{table_file}} (save a table trained on the files), --table={{text|csv|table_file}} (skip counting)" << endl
+             << "         --seek={{KB}} (seek point interval in the index for reading and verifying parts of files, default 1024)," << endl
+             << "         --memory={{MB}} (encoded output kept in memory before it is written, default 256)," << endl
+             << "         --pwrite (every thread writes its chunks at their place in the compressed file)" << endl;
         return 0;
     }
+    PROGRESS.enabled = PROGRESS.enabled && options.show_progress;
+    PHASES.enabled   = options.timing;
+    PHASES.enter(PHASE_WALK);
+    task_pool pool(omp_get_max_threads());   // the walk and both passes run on it (see task_pool.hpp)
+
+    // --table: the lengths come from a trained table (see trained_table.hpp) and the contents are only sampled
+    unsigned char lengths[256] = {0};
+    const bool    trained      = !options.table.empty();
+    if (trained && !options.train.empty()) {
+        cout << "--train and --table cannot be used together" << endl << "Process has been terminated" << endl;
+        return 1;
+    }
+    if (trained && !load_table(options.table, lengths)) {
+        cout << options.table << " is not a translation table" << endl << "Process has been terminated" << endl;
+        return 1;
+    }
 
     string scompressed;
-    FILE * original_fp, *compressed_fp;
+    FILE*  compressed_fp;
 
-    // Validate input files exist
+    // Arguments: files are opened (mapped) here and stay open for both passes, folders are walked below
+    vector<tree_node>  arguments(argc - 1);
+    vector<input_file> inputs(argc);
     for (int i = 1; i < argc; i++) {
-        if (this_is_not_a_folder(argv[i])) {
-            original_fp = fopen(argv[i], "rb");
-            if (!original_fp) {
-                cout << argv[i] << " file does not exist" << endl << "Process has been terminated" << endl;
-                return 0;
-            }
-            fclose(original_fp);
+        struct stat st;
+        if (stat(argv[i], &st)) {
+            cout << argv[i] << " file does not exist" << endl << "Process has been terminated" << endl;
+            return 0;
+        }
+        tree_node& node = arguments[i - 1];
+        node.path = node.name = argv[i];
+        node.folder           = S_ISDIR(st.st_mode);
+        if (!node.folder) {
+            open_the_file(inputs[i], argv[i]);
+            node.size  = inputs[i].size;
+            node.input = &inputs[i];
         }
     }
 
     scompressed = argv[1];
     scompressed += ".compressed";
 
-    unsigned char x;
-    long int      total_size = 0, size;
-    total_bits += 16 + 9 * (argc - 1);
-
-    // Initialize global counters for parallel reduction
-    long int total_number[256] = {0};
-    long int global_total_size = 0;
-    long int global_total_bits = 0;
+    // Every folder is a task that lists its entries and creates one task per subfolder,
+    // idle threads steal the next folder that is waiting, so deep and wide trees are walked on all threads
+    for (tree_node& node : arguments) {
+        if (!node.folder) continue;
+        pool.spawn([&node, &pool] { walk_folder(node, pool); });
+    }
+    pool.wait();
 
-// Parallel region for counting byte frequencies across all input files
-#pragma omp parallel
-    {
-        // Thread-local buffer and counters
-        vector<char> local_buffer(8 * 1024 * 1024);   // 8MB buffer per thread
-        long int     local_number[256] = {0};         // Local byte frequency counter
-        long int     local_total_size  = 0;           // Local size accumulator
-        long int     local_total_bits  = 0;           // Local bit count
-
-// Parallel file processing using guided scheduling for better load balancing
-// nowait allows threads to proceed without synchronization at loop end
-#pragma omp for schedule(guided) nowait
-        for (int current_file = 1; current_file < argc; current_file++) {
-            // Count bytes in filename
-            for (char* c = argv[current_file]; *c; c++) {
-                local_number[(unsigned char)(*c)]++;
-            }
+    vector<tree_node*> records;
+    for (tree_node& node : arguments) {
+        flatten(node, records);
+    }
 
-            if (this_is_not_a_folder(argv[current_file])) {
-                FILE* original_fp = fopen(argv[current_file], "rb");
-                if (!original_fp) {
-#pragma omp critical
-                    { cerr << "Error: Cannot open file " << argv[current_file] << endl; }
-                    continue;
-                }
+    // Names, sizes and the estimate of the header bits are taken from the file list;
+    // file contents are split into byte ranges so one large file is counted by all threads
+    long int total_size = 0;
+    total_bits += 8 * (varint_size(argc - 1) + INDEX_TRAILER_SIZE);   // file count of the arguments and the end of the index
+    vector<count_range>      ranges;
+    vector<vector<long int>> file_histograms;   // whether a file is stored depends on the histogram of the whole file
+    vector<long int>         histogram_record;
+    const bool               positional = options.pwrite && !trained;   // --pwrite needs the counts of every chunk
+    vector<long int>         first_chunk(records.size());   // --pwrite: histogram of the first chunk of every file
+    long int                 chunk_count = 0;
+    for (long int i = 0; i < (long int)records.size(); i++) {
+        tree_node& node = *records[i];
+        for (unsigned char c : node.name) {
+            number[c]++;
+        }
+        // fifth, the name length and the index entry
+        total_bits += 1 + 8 * (varint_size(node.name.size()) + index_entry_size(node.path.size()));
+        if (node.folder) {
+            total_size += 4096;
+            total_bits += 8 * varint_size(node.children.size());   // file count of the folder
+            continue;
+        }
+        total_size += node.size;
+        total_bits += 8 * varint_size(node.size);
+        if (trained) {   // only samples are counted, to find the files the table does not make smaller
+            share_mapping(node, 1);
+            pool.spawn([&, i] {
+                file_use use;
+                records[i]->stored = stored_with_table(map_file(*records[i], use).data, records[i]->size, lengths);
+            });
+            continue;
+        }
+        first_chunk[i] = chunk_count;
+        chunk_count += (node.size + CHUNK_SIZE - 1) / CHUNK_SIZE;
+        PHASES.add_bytes(PHASE_HISTOGRAM, node.size);
+        long int histogram = -1;
+        if (node.size > COUNT_RANGE_SIZE) {
+            histogram = file_histograms.size();
+            file_histograms.push_back(vector<long int>(256, 0));
+            histogram_record.push_back(i);
+        }
+        for (long int offset = 0; offset < node.size; offset += COUNT_RANGE_SIZE) {
+            ranges.push_back(count_range{i, offset, min(COUNT_RANGE_SIZE, node.size - offset), histogram});
+        }
+        share_mapping(node, (node.size + COUNT_RANGE_SIZE - 1) / COUNT_RANGE_SIZE);
+    }
 
-                // Process file in chunks using the thread-local buffer
-                size_t size = size_of_the_file(argv[current_file]);
-                local_total_size += size;
-                local_total_bits += 64;
-
-                size_t bytes_read;
-                while ((bytes_read = fread(local_buffer.data(), 1, local_buffer.size(), original_fp)) > 0) {
-// Vectorized byte counting
-#pragma omp simd
-                    for (size_t j = 0; j < bytes_read; j++) {
-                        local_number[(unsigned char)local_buffer[j]]++;
+    vector<uint32_t> chunk_histograms(positional ? 256 * chunk_count : 0);
+    PHASES.enter(PHASE_HISTOGRAM);
+
+    // Ranges are counted concurrently straight from the mappings: arguments are mapped for the whole run, a file inside
+    // a folder is mapped once by the first task of its ranges (see share_mapping). The largest ranges are spawned first.
+    // A file that fits in one range is stored or added to the counters of its thread right away (see STORED_ENTROPY
+    // in histogram.hpp), the ranges of larger files go to the histogram of their file first
+    vector<long int> order(ranges.size());
+    vector<long int> local_numbers(256 * pool.size(), 0);   // byte frequencies counted by every thread
+    for (long int i = 0; i < (long int)ranges.size(); i++) {
+        order[i] = i;
+    }
+    stable_sort(order.begin(), order.end(), [&](long int a, long int b) { return ranges[a].length > ranges[b].length; });
+    for (long int i : order) {
+        pool.spawn([&, i] {
+            const count_range& range = ranges[i];
+            tree_node&         node  = *records[range.record];
+            file_use           use;
+            const input_file&  input            = map_file(node, use);
+            long int           file_number[256] = {0};
+            if (positional) {   // the histogram of every chunk gives its encoded size later
+                for (long int done = 0; done < range.length; done += CHUNK_SIZE) {
+                    long int  chunk_number[256] = {0};
+                    uint32_t* histogram         = &chunk_histograms[256 * (first_chunk[range.record] + (range.offset + done) / CHUNK_SIZE)];
+                    count_bytes(input.data + range.offset + done, min(CHUNK_SIZE, range.length - done), chunk_number);
+                    for (int c = 0; c < 256; c++) {
+                        histogram[c] = chunk_number[c];
+                        file_number[c] += chunk_number[c];
                     }
                 }
-                fclose(original_fp);
             } else {
-                string temp = argv[current_file];
-                count_in_folder(temp, local_number, local_total_size, local_total_bits);
+                count_bytes(input.data + range.offset, range.length, file_number);
             }
-        }
-
-// Merge thread-local counters into global counters using critical section
-#pragma omp critical
-        {
-            for (int i = 0; i < 256; i++) {
-                total_number[i] += local_number[i];
+            if (range.histogram >= 0) {
+                for (int c = 0; c < 256; c++) {
+                    __atomic_fetch_add(&file_histograms[range.histogram][c], file_number[c], __ATOMIC_RELAXED);
+                }
+            } else if (bits_per_byte(file_number) >= STORED_ENTROPY) {
+                node.stored = true;
+            } else {
+                long int* local_number = &local_numbers[256 * pool.worker()];
+                for (int c = 0; c < 256; c++) {
+                    local_number[c] += file_number[c];
+                }
             }
-            global_total_size += local_total_size;
-            global_total_bits += local_total_bits;
+        });
+    }
+    pool.wait();
+    for (int t = 0; t < pool.size(); t++) {
+        for (int c = 0; c < 256; c++) {
+            number[c] += local_numbers[256 * t + c];
         }
     }
 
-    // Copy final counts to the main array
-    memcpy(number, total_number, sizeof(number));
-    total_size += global_total_size;
-    total_bits += global_total_bits;
+    for (size_t h = 0; h < file_histograms.size(); h++) {
+        if (bits_per_byte(file_histograms[h].data()) >= STORED_ENTROPY) {
+            records[histogram_record[h]]->stored = true;
+            continue;
+        }
+        for (int c = 0; c < 256; c++) {
+            number[c] += file_histograms[h][c];
+        }
+    }
+    long int stored_bytes = 0;
+    for (tree_node* node : records) {
+        if (!node->stored) continue;
+        stored_bytes += node->size;
+        total_bits += 8 * node->size + 8;   // the bytes and at most 8 bits of padding
+    }
 
-    // Count unique bytes for Huffman tree construction
+    // Count unique bytes for Huffman tree construction, a trained table gives a length to every byte
     for (long int* i = number; i < number + 256; i++) {
-        if (*i) {
+        if (*i || lengths[i - number]) {
             letter_count++;
         }
     }
 
-    // Initialize Huffman tree nodes array
-    ersel  array[512];   // Maximum size for Huffman tree (2n-1 nodes for n unique bytes)
-    int    array_size = 0;
-    ersel* e          = array;
-    for (long int* i = number; i < number + 256; i++) {
-        if (*i) {
-            e->right     = NULL;
-            e->left      = NULL;
-            e->number    = *i;
-            e->character = i - number;
-            e++;
-            array_size++;
+    // --train: the counts become a translation table that later runs can use with --table, nothing is compressed
+    if (!options.train.empty()) {
+        train_table(number, lengths);
+        if (!save_table(options.train, lengths)) {
+            cout << options.train << " could not be written" << endl << "Process has been terminated" << endl;
+            return 1;
         }
+        cout << "Created translation table: " << options.train << endl;
+        return 0;
     }
-    sort(array, array + array_size, erselcompare0);
-
-    // Build Huffman tree by repeatedly combining lowest frequency nodes
-    ersel *min1 = array, *min2 = array + 1, *current = array + array_size;
-    ersel *notleaf = array + array_size, *isleaf = array + 2;
-    int    total_nodes = array_size;
-    for (int i = 0; i < array_size - 1; i++) {
-        current->number = min1->number + min2->number;
-        current->left   = min1;
-        current->right  = min2;
-        min1->bit       = "1";
-        min2->bit       = "0";
-        current++;
-        total_nodes++;
-
-        // Select next minimum frequency nodes
-        if (isleaf >= array + array_size) {
-            min1 = notleaf;
-            notleaf++;
-        } else {
-            if (isleaf->number < notleaf->number) {
-                min1 = isleaf;
-                isleaf++;
-            } else {
-                min1 = notleaf;
-                notleaf++;
-            }
-        }
 
-        if (isleaf >= array + array_size) {
-            min2 = notleaf;
-            notleaf++;
-        } else if (notleaf >= current) {
-            min2 = isleaf;
-            isleaf++;
-        } else {
-            if (isleaf->number < notleaf->number) {
-                min2 = isleaf;
-                isleaf++;
-            } else {
-                min2 = notleaf;
-                notleaf++;
-            }
-        }
+    PHASES.enter(PHASE_TREE);
+
+    // Huffman code lengths from the frequencies, the same builder as the serial compressor and huffman_block.cpp
+    long int counted_bytes = 0;
+    for (long int* i = number; i < number + 256; i++) {
+        counted_bytes += *i;
+    }
+    if (!trained) {
+        huffman_code_lengths(number, lengths);
     }
 
-    // Assign Huffman codes starting from root
-    ersel* root = current - 1;
-    assign_codes(root, "");
+    // Limit code lengths to MAX_CODE_LENGTH and derive the canonical code words from the lengths
+    if (!trained) {
+        limit_code_lengths(lengths, number, MAX_CODE_LENGTH);
+    }
+    code_table codes;
+    codes.assign_canonical(lengths);
 
     // Open output file and initialize bit buffer
+    PHASES.enter(PHASE_HEADER);
     compressed_fp                   = fopen(&scompressed[0], "wb");
     int           current_bit_count = 0;
     unsigned char current_byte      = 0;
 
-    // Write header information
-    fwrite(&letter_count, 1, 1, compressed_fp);
-    total_bits += 8;
+    // Write header information: the format version and the number of unique bytes
+    unsigned char varint[MAX_VARINT_BYTES];
+    int           varint_length = encode_varint(letter_count, varint);
+    fwrite(FORMAT_MAGIC, 1, sizeof(FORMAT_MAGIC), compressed_fp);
+    fputc(FORMAT_VERSION, compressed_fp);
+    fwrite(varint, 1, varint_length, compressed_fp);
+    total_bits += 8 * (sizeof(FORMAT_MAGIC) + 1 + varint_length);
 
     // Handle password protection
     {
-        cout << "If you want a password write any number other than 0" << endl << "If you do not, write 0" << endl;
-        int check_password;
-        cin >> check_password;
+        int    check_password = options.has_password;
+        string password       = options.password;
+        // Only ask when the command line did not answer
+        if (options.ask_password) {
+            PHASES.enter(PHASE_NONE);   // waiting for the user is not measured
+            cout << "If you want a password write any number other than 0" << endl << "If you do not, write 0" << endl;
+            cin >> check_password;
+            if (check_password) {
+                cout << "Enter your password (Do not use whitespaces): ";
+                cin >> password;
+            }
+        }
         if (check_password) {
-            string password;
-            cout << "Enter your password (Do not use whitespaces): ";
-            cin >> password;
             int password_length = password.length();
             if (password_length == 0) {
                 cout << "You did not enter a password" << endl << "Process has been terminated" << endl;
@@ -263,44 +455,16 @@ int main(int argc, char* argv[]) {
         }
     }
 
-    // Write Huffman coding table
-    char*         str_pointer;
+    // Write Huffman coding table: every unique byte and the length of its code
     unsigned char len, current_character;
-    string        str_arr[256];
-    for (e = array; e < array + array_size; e++) {
-        str_arr[(e->character)] = e->bit;   // Store Huffman codes for each byte
-        len                     = e->bit.length();
-        current_character       = e->character;
+    for (int c = 0; c < 256; c++) {
+        if (!number[c] && !lengths[c]) continue;
+        len               = codes.length[c];
+        current_character = c;
 
         write_from_uChar(current_character, current_byte, current_bit_count, compressed_fp);
         write_from_uChar(len, current_byte, current_bit_count, compressed_fp);
-        total_bits += len + 16;
-
-        str_pointer = &e->bit[0];
-        while (*str_pointer) {
-            if (current_bit_count == 8) {
-                fwrite(&current_byte, 1, 1, compressed_fp);
-                current_byte      = 0;
-                current_bit_count = 0;
-            }
-            switch (*str_pointer) {
-            case '1':
-                current_byte <<= 1;
-                current_byte |= 1;
-                current_bit_count++;
-                break;
-            case '0':
-                current_byte <<= 1;
-                current_bit_count++;
-                break;
-            default:
-                cout << "An error has occurred" << endl << "Compression process aborted" << endl;
-                fclose(compressed_fp);
-                remove(&scompressed[0]);
-                return 1;
-            }
-            str_pointer++;
-        }
+        total_bits += 16 + len * number[c];
     }
 
     // Pad last byte with zeros if needed
@@ -310,15 +474,22 @@ int main(int argc, char* argv[]) {
 
     // Display compression statistics
     cout << "The size of the sum of ORIGINAL files is: " << total_size << " bytes" << endl;
-    cout << "The size of the COMPRESSED file will be: " << total_bits / 8 << " bytes" << endl;
-    cout << "Compressed file's size will be [%" << 100 * ((float)total_bits / 8 / total_size) << "] of the original file" << endl;
-    if (total_bits / 8 > total_size) {
-        cout << endl << "COMPRESSED FILE'S SIZE WILL BE HIGHER THAN THE SUM OF ORIGINALS" << endl << endl;
-    }
-    cout << "If you wish to abort this process write 0 and press enter" << endl
-         << "If you want to continue write any other number and press enter" << endl;
-    int check;
-    cin >> check;
+    if (trained) {   // the contents were not counted, so there is nothing to estimate from
+        cout << "The size of the COMPRESSED file is not known before compression with a trained table" << endl;
+    } else {
+        cout << "The size of the COMPRESSED file will be: " << total_bits / 8 << " bytes" << endl;
+        cout << "Compressed file's size will be [%" << 100 * ((float)total_bits / 8 / total_size) << "] of the original file" << endl;
+        if (total_bits / 8 > total_size) {
+            cout << endl << "COMPRESSED FILE'S SIZE WILL BE HIGHER THAN THE SUM OF ORIGINALS" << endl << endl;
+        }
+    }
+    int check = 1;
+    if (options.ask_confirmation) {
+        PHASES.enter(PHASE_NONE);
+        cout << "If you wish to abort this process write 0 and press enter" << endl
+             << "If you want to continue write any other number and press enter" << endl;
+        cin >> check;
+    }
     if (!check) {
         cout << endl << "Process has been aborted" << endl;
         fclose(compressed_fp);
@@ -327,305 +498,498 @@ int main(int argc, char* argv[]) {
     }
 
     // Set progress bar maximum
-    PROGRESS.MAX = root->number;
+    PROGRESS.MAX = trained ? total_size : counted_bytes + stored_bytes;
 
     // Write file count to output
+    PHASES.enter(PHASE_HEADER);
     write_file_count(argc - 1, current_byte, current_bit_count, compressed_fp);
-
-    // Prepare thread-local buffers for parallel compression
-    const int                     num_threads = omp_get_max_threads();
-    vector<vector<unsigned char>> thread_buffers(num_threads);
-    vector<int>                   buffer_bit_counts(num_threads, 0);
-    vector<unsigned char>         current_bytes(num_threads, 0);
-
-// Parallel compression of input files
-#pragma omp parallel
-    {
-        const int thread_id = omp_get_thread_num();
-        thread_buffers[thread_id].reserve(8 * 1024 * 1024);   // 8MB initial buffer per thread
-
-// Process files in parallel using guided scheduling
-#pragma omp for schedule(guided)
-        for (int current_file = 1; current_file < argc; current_file++) {
-            if (this_is_not_a_folder(argv[current_file])) {
-                FILE* local_original_fp = fopen(argv[current_file], "rb");
-                if (!local_original_fp) {
-#pragma omp critical
-                    { cerr << "Error: Cannot open file " << argv[current_file] << " for compression" << endl; }
-                    continue;
-                }
-
-                long int size = size_of_the_file(argv[current_file]);
-
-                // Pre-allocate buffer space based on estimated compression ratio
-                thread_buffers[thread_id].reserve(thread_buffers[thread_id].size() + size / 4);
-
-                // Write file marker and size
-                current_bytes[thread_id] <<= 1;
-                current_bytes[thread_id] |= 1;
-                buffer_bit_counts[thread_id]++;
-                write_file_size(size, current_bytes[thread_id], buffer_bit_counts[thread_id], thread_buffers[thread_id]);
-
-                // Compress file content using Huffman codes
-                write_the_file_content(
-                    local_original_fp, size, str_arr, current_bytes[thread_id], buffer_bit_counts[thread_id], thread_buffers[thread_id]);
-
-                fclose(local_original_fp);
-
-                // Flush remaining bits in thread buffer
-                if (buffer_bit_counts[thread_id] > 0) {
-                    current_bytes[thread_id] <<= (8 - buffer_bit_counts[thread_id]);
-                    thread_buffers[thread_id].push_back(current_bytes[thread_id]);
-                    buffer_bit_counts[thread_id] = 0;
-                    current_bytes[thread_id]     = 0;
-                }
-            }
+    PHASES.add_bytes(PHASE_HEADER, ftell(compressed_fp));
+
+    // Records are cut into pieces in the order of the format. The pieces are encoded on all threads into a ring of
+    // output slots that holds about --memory bytes, and a writer thread appends them to the compressed file in order.
+    // With --pwrite every thread writes its pieces at their place in the compressed file instead (see write_pieces_at)
+    vector<piece> pieces;
+    long int      content_bytes = 0;
+    for (long int i = 0; i < (long int)records.size(); i++) {
+        pieces.push_back(piece{i, HEADER_PIECE, 0});
+        if (records[i]->stored) {
+            pieces.push_back(piece{i, STORED_PIECE, records[i]->size});
+            share_mapping(*records[i], positional ? 1 : 2);   // without --pwrite the writer thread copies it
+            continue;
+        }
+        for (long int offset = 0; !records[i]->folder && offset < records[i]->size; offset += CHUNK_SIZE) {
+            pieces.push_back(piece{i, offset, min(CHUNK_SIZE, records[i]->size - offset)});
+            content_bytes += pieces.back().length;
         }
+        share_mapping(*records[i], (records[i]->size + CHUNK_SIZE - 1) / CHUNK_SIZE);
+    }
+    if (current_bit_count == 8) {   // the writer keeps less than 8 pending bits
+        fwrite(&current_byte, 1, 1, compressed_fp);
+        current_byte      = 0;
+        current_bit_count = 0;
     }
 
-    // Write compressed data using large buffer for efficiency
-    const size_t          WRITE_BUFFER_SIZE = 8 * 1024 * 1024;   // 8MB write buffer
-    vector<unsigned char> write_buffer;
-    write_buffer.reserve(WRITE_BUFFER_SIZE);
-
-    // Merge and write thread buffers sequentially
-    for (int i = 0; i < num_threads; i++) {
-        if (thread_buffers[i].empty()) continue;
+    PHASES.enter(PHASE_ENCODE);
+    PHASES.add_bytes(PHASE_ENCODE, content_bytes);
+    if (positional) {
+        write_pieces_at(pieces, records, chunk_histograms, first_chunk, options.seek_interval, codes, current_byte, current_bit_count,
+                        compressed_fp, pool);
+    } else {
+        // an encoded chunk takes up to about twice its input with the growth of its buffer
+        // pieces start in order, see output_ring
+        output_ring  ring(max((long int)pool.size() + 1, options.memory / (2 * CHUNK_SIZE)));
+        thread_clock writer_clock(options.timing);
+        thread       writer([&] { write_pieces(pieces, records, ring, current_byte, current_bit_count, compressed_fp, writer_clock); });
+        pool.for_each_in_order(pieces.size(), [&](long int i) {
+            const piece&   p     = pieces[i];
+            tree_node&     node  = *records[p.record];
+            encoded_chunk& chunk = ring.acquire(i);
+            if (p.offset == HEADER_PIECE) {
+                encode_header(node, codes, chunk, 0);   // writes fifth to seventh (and fourth of a folder)
+            } else if (p.offset == STORED_PIECE) {
+                file_use use;
+                checksum_stored(node, map_file(node, use));
+            } else {
+                file_use          use;
+                const input_file& input = map_file(node, use);
+                encode_chunk(input.data, p.offset, p.length, options.seek_interval, codes, chunk, 0);   // writes eighth
+                PROGRESS.add(p.length);
+            }
+            ring.publish(i);
+        });
+        writer.join();
+        PHASES.add_thread_time(writer_clock, PHASE_ENCODE);   // the writer stitched and wrote while the chunks were encoded
+    }
+    inputs.clear();
 
-        // Flush write buffer if it would overflow
-        if (write_buffer.size() + thread_buffers[i].size() > WRITE_BUFFER_SIZE) {
-            fwrite(write_buffer.data(), 1, write_buffer.size(), compressed_fp);
-            write_buffer.clear();
-        }
-        write_buffer.insert(write_buffer.end(), thread_buffers[i].begin(), thread_buffers[i].end());
+    // Pad and write the last byte
+    PHASES.enter(PHASE_WRITE);
+    if (current_bit_count) {
+        current_byte <<= 8 - current_bit_count;
+        fwrite(&current_byte, 1, 1, compressed_fp);
     }
 
-    // Write any remaining data
-    if (!write_buffer.empty()) {
-        fwrite(write_buffer.data(), 1, write_buffer.size(), compressed_fp);
+    // Write the index (ninth part, see archive_format.hpp)
+    vector<index_entry> index(records.size());
+    for (size_t i = 0; i < records.size(); i++) {
+        index[i].path          = records[i]->path;
+        index[i].size          = records[i]->size;
+        index[i].offset        = records[i]->offset;
+        index[i].flags         = records[i]->folder ? INDEX_FOLDER : records[i]->stored ? INDEX_STORED : 0;
+        index[i].seek_interval = options.seek_interval;
+        index[i].seek_points.swap(records[i]->seek_points);
+        index[i].checksums.swap(records[i]->checksums);
     }
+    write_index(compressed_fp, index);
 
     // Cleanup and finish
-    fclose(compressed_fp);
+    long int compressed_size = ftell(compressed_fp);
+    if (ferror(compressed_fp) | fclose(compressed_fp)) {   // e.g. the disk is full
+        cout << endl << "The compressed file could not be written" << endl << "Process has been aborted" << endl;
+        exit(1);
+    }
+    PROGRESS.finish();
+    if (options.timing &&
+        !PHASES.report("modified_archive", omp_get_max_threads(), PHASES.bytes[PHASE_HISTOGRAM], compressed_size, options.timing_file)) {
+        cout << options.timing_file << " could not be written" << endl;
+    }
     cout << endl << "Created compressed file: " << scompressed << endl;
+    if (trained) {
+        cout << "The size of the COMPRESSED file is: " << compressed_size << " bytes" << endl;
+    }
     cout << "Compression is complete" << endl;
 
     return 0;
 }
 
-// Modified functions to support thread-local buffers
-
-void write_from_uChar(unsigned char uChar, unsigned char& current_byte, int& current_bit_count, vector<unsigned char>& buffer) {
-    for (int i = 0; i < 8; i++) {
-        if (current_bit_count == 8) {
-            buffer.push_back(current_byte);
-            current_byte      = 0;
-            current_bit_count = 0;
-        }
-        current_byte <<= 1;
-        current_byte |= (uChar >> (7 - i)) & 1;
-        current_bit_count++;
+void write_bit(int bit, unsigned char& current_byte, int& current_bit_count, FILE* fp_write) {
+    if (current_bit_count == 8) {
+        fwrite(&current_byte, 1, 1, fp_write);
+        current_byte      = 0;
+        current_bit_count = 0;
     }
+    current_byte <<= 1;
+    current_byte |= bit;
+    current_bit_count++;
 }
 
 void write_from_uChar(unsigned char uChar, unsigned char& current_byte, int& current_bit_count, FILE* fp_write) {
     for (int i = 0; i < 8; i++) {
-        if (current_bit_count == 8) {
-            fwrite(&current_byte, 1, 1, fp_write);
-            current_byte      = 0;
-            current_bit_count = 0;
-        }
-        current_byte <<= 1;
-        current_byte |= (uChar >> (7 - i)) & 1;
-        current_bit_count++;
+        write_bit((uChar >> (7 - i)) & 1, current_byte, current_bit_count, fp_write);
     }
 }
 
+// Fourth part: varint (see encode_varint in archive_format.hpp)
 void write_file_count(int file_count, unsigned char& current_byte, int& current_bit_count, FILE* compressed_fp) {
-    unsigned char temp = file_count % 256;
-    write_from_uChar(temp, current_byte, current_bit_count, compressed_fp);
-    temp = file_count / 256;
-    write_from_uChar(temp, current_byte, current_bit_count, compressed_fp);
+    unsigned char bytes[MAX_VARINT_BYTES];
+    int           length = encode_varint(file_count, bytes);
+    for (int i = 0; i < length; i++) {
+        write_from_uChar(bytes[i], current_byte, current_bit_count, compressed_fp);
+    }
 }
 
-void write_file_size(long int size, unsigned char& current_byte, int& current_bit_count, vector<unsigned char>& buffer) {
-    for (int i = 0; i < 8; i++) {
-        unsigned char temp = (size >> ((7 - i) * 8)) & 0xFF;
-        write_from_uChar(temp, current_byte, current_bit_count, buffer);
+// Appends a varint to an encoded header
+void put_varint(bit_writer<vector_sink>& writer, uint64_t value) {
+    unsigned char bytes[MAX_VARINT_BYTES];
+    int           length = encode_varint(value, bytes);
+    for (int i = 0; i < length; i++) {
+        writer.put(bytes[i], 8);
     }
 }
 
-void write_file_name(char* file_name, string* str_arr, unsigned char& current_byte, int& current_bit_count, vector<unsigned char>& buffer) {
-    write_from_uChar(strlen(file_name), current_byte, current_bit_count, buffer);
-    char* str_pointer;
-    for (char* c = file_name; *c; c++) {
-        str_pointer = &str_arr[(unsigned char)(*c)][0];
-        while (*str_pointer) {
-            if (current_bit_count == 8) {
-                buffer.push_back(current_byte);
-                current_byte      = 0;
-                current_bit_count = 0;
-            }
-            switch (*str_pointer) {
-            case '1':
-                current_byte <<= 1;
-                current_byte |= 1;
-                current_bit_count++;
-                break;
-            case '0':
-                current_byte <<= 1;
-                current_bit_count++;
-                break;
-            default: cout << "An error has occurred" << endl << "Process has been aborted"; exit(2);
-            }
-            str_pointer++;
-        }
+// Header of a record: fifth, sixth (varint, STORED_FILE set for stored files) and seventh part of a file,
+// or fifth and seventh part of a folder followed by the fourth part (the number of its entries).
+// The encoded pieces start with skip zero bits, the place of the bits of the pieces before them in a shared byte
+void encode_header(const tree_node& node, code_table& codes, encoded_chunk& chunk, int skip) {
+    chunk.bytes.clear();
+    chunk.seek_points.clear();
+    unsigned char           last_byte  = 0;
+    int                     last_count = 0;
+    bit_writer<vector_sink> writer(vector_sink{chunk.bytes}, 0, skip, 64);
+    writer.put(node.folder ? 0 : 1, 1);
+    if (!node.folder) put_varint(writer, node.stored ? node.size | STORED_FILE : node.size);
+    put_varint(writer, node.name.size());
+    writer.encode((const unsigned char*)node.name.data(), node.name.size(), codes);
+    if (node.folder) put_varint(writer, node.children.size());
+    writer.finish(last_byte, last_count);
+    chunk.bits = 8 * (long int)chunk.bytes.size() + last_count;
+    if (last_count) chunk.bytes.push_back(last_byte << (8 - last_count));
+}
+
+// Encodes length bytes of a file starting at offset into chunk. With seek_interval, the bit position of every
+// multiple of seek_interval in [offset, offset + length) except the start of the file is kept for the index
+void encode_chunk(const unsigned char* data, long int offset, long int length, long int seek_interval, code_table& codes,
+                  encoded_chunk& chunk, int skip) {
+    chunk.bytes.clear();
+    chunk.seek_points.clear();
+    unsigned char           last_byte  = 0;
+    int                     last_count = 0;
+    bit_writer<vector_sink> writer(vector_sink{chunk.bytes}, 0, skip);
+    for (long int done = offset, end = offset + length, next; done < end; done = next) {
+        next = seek_interval ? min(end, (done / seek_interval + 1) * seek_interval) : end;
+        if (seek_interval && done && done % seek_interval == 0) chunk.seek_points.push_back(writer.bits());
+        writer.encode(data + done, next - done, codes);
     }
+    writer.finish(last_byte, last_count);
+    chunk.bits = 8 * (long int)chunk.bytes.size() + last_count;
+    if (last_count) chunk.bytes.push_back(last_byte << (8 - last_count));
+    chunk.checksum = crc32c(data + offset, length);
 }
 
-void write_the_file_content(FILE* original_fp, long int size, string* str_arr, unsigned char& current_byte, int& current_bit_count,
-                            vector<unsigned char>& buffer) {
-    unsigned char x;
-    char*         str_pointer;
-    for (long int i = 0; i < size; i++) {
-        fread(&x, 1, 1, original_fp);
-        str_pointer = &str_arr[x][0];
-        while (*str_pointer) {
-            if (current_bit_count == 8) {
-                buffer.push_back(current_byte);
-                current_byte      = 0;
-                current_bit_count = 0;
-            }
-            switch (*str_pointer) {
-            case '1':
-                current_byte <<= 1;
-                current_byte |= 1;
-                current_bit_count++;
-                break;
-            case '0':
-                current_byte <<= 1;
-                current_bit_count++;
-                break;
-            default: cout << "An error has occurred" << endl << "Process has been aborted"; exit(2);
-            }
-            str_pointer++;
+// Appends the bits of chunk to output after the pending bits of the compressed file (less than 8, in the low bits
+// of current_byte), the bits that do not make a whole byte are left pending
+void append_chunk(const encoded_chunk& chunk, unsigned char& current_byte, int& current_bit_count, vector<unsigned char>& output) {
+    const long int whole   = chunk.bits / 8;
+    const int      rest    = chunk.bits % 8;
+    const int      count   = current_bit_count;
+    unsigned       pending = current_byte;
+    if (!count) {
+        output.insert(output.end(), chunk.bytes.begin(), chunk.bytes.begin() + whole);
+    } else {
+        for (long int j = 0; j < whole; j++) {
+            output.push_back(pending << (8 - count) | chunk.bytes[j] >> count);
+            pending = chunk.bytes[j] & ((1u << count) - 1);
         }
     }
+    current_bit_count = count + rest;
+    if (rest) pending = pending << rest | chunk.bytes[whole] >> (8 - rest);
+    if (current_bit_count >= 8) {
+        current_bit_count -= 8;
+        output.push_back(pending >> current_bit_count);
+        pending &= (1u << current_bit_count) - 1;
+    }
+    current_byte = pending;
 }
 
-void write_the_folder(string path, string* str_arr, unsigned char& current_byte, int& current_bit_count, vector<unsigned char>& buffer) {
-    FILE* original_fp;
-    path += '/';
-    DIR *          dir = opendir(&path[0]), *next_dir;
-    string         next_path;
-    struct dirent* current;
-    int            file_count = 0;
-    long int       size;
-    while ((current = readdir(dir))) {
-        if (current->d_name[0] == '.') {
-            if (current->d_name[1] == 0) continue;
-            if (current->d_name[1] == '.' && current->d_name[2] == 0) continue;
+// Writer thread: takes the pieces from the ring in order and appends them to the compressed file. The bit position
+// of every piece is known here, so the offsets and seek points of the index are filled in as well.
+// Stored files are copied by the kernel between two pieces. The time spent stitching the bits of the pieces
+// goes to the merge phase of clock and the time spent writing to the write phase, waiting for a piece is not counted
+void write_pieces(const vector<piece>& pieces, const vector<tree_node*>& records, output_ring& ring, unsigned char& current_byte,
+                  int& current_bit_count, FILE* compressed_fp, thread_clock& clock) {
+    vector<unsigned char> output;
+    long int              position = ftell(compressed_fp) * 8 + current_bit_count;
+    auto                  flush    = [&] {
+        clock.start();
+        fwrite(output.data(), 1, output.size(), compressed_fp);
+        clock.stop(PHASE_WRITE);
+        PHASES.add_bytes(PHASE_WRITE, output.size());
+        output.clear();
+    };
+    for (long int i = 0; i < (long int)pieces.size(); i++) {
+        const encoded_chunk& chunk = ring.next(i);
+        tree_node&           node  = *records[pieces[i].record];
+        if (pieces[i].offset == STORED_PIECE) {
+            flush();
+            clock.start();
+            write_stored_content(node, current_byte, current_bit_count, compressed_fp);   // writes eighth
+            clock.stop(PHASE_WRITE);
+            position = ftell(compressed_fp) * 8;
+            ring.release(i);
+            continue;
         }
-        file_count++;
-    }
-    rewinddir(dir);
-    // Writes fourth
-    unsigned char temp = file_count % 256;
-    write_from_uChar(temp, current_byte, current_bit_count, buffer);
-    temp = file_count / 256;
-    write_from_uChar(temp, current_byte, current_bit_count, buffer);
 
-    while ((current = readdir(dir))) {   // if current is a file
-        if (current->d_name[0] == '.') {
-            if (current->d_name[1] == 0) continue;
-            if (current->d_name[1] == '.' && current->d_name[2] == 0) continue;
+        // the content of a file starts where its header ends (at the next byte boundary if it is stored),
+        // seek points are found from the start of their chunk
+        for (long int point : chunk.seek_points) {
+            node.seek_points.push_back(position + point);
         }
+        if (pieces[i].offset >= 0) node.checksums.push_back(chunk.checksum);
+        position += chunk.bits;
+        if (pieces[i].offset == HEADER_PIECE && !node.folder) node.offset = node.stored ? (position + 7) / 8 * 8 : position;
+
+        clock.start();
+        append_chunk(chunk, current_byte, current_bit_count, output);
+        clock.stop(PHASE_MERGE);
+        PHASES.add_bytes(PHASE_MERGE, chunk.bytes.size());
+        ring.release(i);
+        if (output.size() >= OUTPUT_FLUSH) flush();
+    }
+    flush();
+}
+
+// Bits of the header of a record (see encode_header)
+long int header_bits(const tree_node& node, const code_table& codes) {
+    long int bits = 1 + 8 * varint_size(node.name.size());
+    for (unsigned char c : node.name) {
+        bits += codes.length[c];
+    }
+    if (node.folder) return bits + 8 * varint_size(node.children.size());
+    return bits + 8 * varint_size(node.stored ? node.size | STORED_FILE : node.size);
+}
 
-        next_path = path + current->d_name;
-        if (this_is_not_a_folder(&next_path[0])) {
-            original_fp = fopen(&next_path[0], "rb");
-            fseek(original_fp, 0, SEEK_END);
-            size = ftell(original_fp);
-            rewind(original_fp);
-
-            // Writing fifth
-            current_byte <<= 1;
-            current_byte |= 1;
-            current_bit_count++;
-
-            write_file_size(size, current_byte, current_bit_count, buffer);                                // writes sixth
-            write_file_name(current->d_name, str_arr, current_byte, current_bit_count, buffer);            // writes seventh
-            write_the_file_content(original_fp, size, str_arr, current_byte, current_bit_count, buffer);   // writes eighth
-            fclose(original_fp);
-        } else {   // if current is a folder
-            // Writing fifth
-            current_byte <<= 1;
-            current_bit_count++;
-
-            write_file_name(current->d_name, str_arr, current_byte, current_bit_count, buffer);   // writes seventh
-
-            write_the_folder(next_path, str_arr, current_byte, current_bit_count, buffer);
+// --pwrite: the bits of every piece are known before it is encoded, headers from the names and sizes and chunks
+// from their histograms of the first pass and the code lengths, so the bit offset of every piece is a prefix sum.
+// The compressed file is preallocated, and every thread encodes its pieces with the bits of the pieces before them
+// left as zeros in the first byte and writes the bytes that are only its own at their place with pwrite.
+// The bytes two pieces share are put together and written at the end, the stream position of the compressed file is
+// moved past the last byte
+void write_pieces_at(const vector<piece>& pieces, const vector<tree_node*>& records, const vector<uint32_t>& chunk_histograms,
+                     const vector<long int>& first_chunk, long int seek_interval, code_table& codes, unsigned char& current_byte,
+                     int& current_bit_count, FILE* compressed_fp, task_pool& pool) {
+    const long int   count = pieces.size();
+    vector<uint64_t> start(count + 1);   // first bit of every piece, and the end of the last one
+    vector<uint64_t> end(count);         // bit after every piece, before the padding of a stored file after it
+    fflush(compressed_fp);
+    start[0] = ftell(compressed_fp) * 8 + current_bit_count;
+    for (long int i = 0; i < count; i++) {
+        const piece& p    = pieces[i];
+        tree_node&   node = *records[p.record];
+        if (p.offset == HEADER_PIECE) {
+            start[i + 1] = start[i] + header_bits(node, codes);
+            end[i]       = start[i + 1];
+            if (node.folder) continue;
+            node.offset = node.stored ? (start[i + 1] + 7) / 8 * 8 : start[i + 1];
+            if (node.stored) continue;
+            node.checksums.resize((node.size + CHUNK_SIZE - 1) / CHUNK_SIZE);
+            if (seek_interval && node.size) node.seek_points.resize((node.size - 1) / seek_interval);
+        } else if (p.offset == STORED_PIECE) {
+            start[i]     = node.offset;
+            start[i + 1] = start[i] + 8 * p.length;
+            end[i]       = start[i + 1];
+        } else {
+            const uint32_t* histogram = &chunk_histograms[256 * (first_chunk[p.record] + p.offset / CHUNK_SIZE)];
+            long int        bits      = 0;
+            for (int c = 0; c < 256; c++) {
+                bits += (long int)histogram[c] * codes.length[c];
+            }
+            start[i + 1] = start[i] + bits;
+            end[i]       = start[i + 1];
         }
     }
-    closedir(dir);
+    const int fd = fileno(compressed_fp);
+    fallocate(fd, 0, 0, (start[count] + 7) / 8);   // file systems that cannot preallocate grow with the writes
+
+    // the pieces that take the longest (stored files, then chunks) are spawned first, headers last
+    vector<unsigned char> first(count), last(count);   // bytes shared with the piece before and the piece after
+    vector<encoded_chunk> chunks(pool.size());          // buffer of every thread
+    vector<thread_clock>  clocks(pool.size(), thread_clock(PHASES.enabled));
+    vector<long int>      order(count);
+    atomic<bool>          failed{false};
+    for (long int i = 0; i < count; i++) {
+        order[i] = i;
+    }
+    stable_sort(order.begin(), order.end(), [&](long int a, long int b) { return pieces[a].length > pieces[b].length; });
+    for (long int i : order) {
+        pool.spawn([&, i] {
+            const piece&   p     = pieces[i];
+            tree_node&     node  = *records[p.record];
+            encoded_chunk& chunk = chunks[pool.worker()];
+            const int      skip  = start[i] % 8;
+            const off_t    byte  = start[i] / 8;
+            if (p.offset == STORED_PIECE) {
+                file_use          use;
+                const input_file& input = map_file(node, use);
+                checksum_stored(node, input);
+                clocks[pool.worker()].start();
+                if (!copy_input_at(input, node.path.c_str(), fd, byte)) failed = true;   // writes eighth
+                clocks[pool.worker()].stop(PHASE_WRITE);
+                PHASES.add_bytes(PHASE_WRITE, input.size);
+                PROGRESS.add(input.size);
+                return;
+            }
+            if (p.offset == HEADER_PIECE) {
+                encode_header(node, codes, chunk, skip);   // writes fifth to seventh (and fourth of a folder)
+            } else {
+                file_use          use;
+                const input_file& input = map_file(node, use);
+                encode_chunk(input.data, p.offset, p.length, seek_interval, codes, chunk, skip);   // writes eighth
+                node.checksums[p.offset / CHUNK_SIZE] = chunk.checksum;
+                long int point                        = seek_interval ? (p.offset + seek_interval - 1) / seek_interval : 0;
+                if (point == 0) point = 1;   // the start of the file is not a seek point
+                for (size_t k = 0; k < chunk.seek_points.size(); k++) {
+                    node.seek_points[point - 1 + k] = 8 * byte + chunk.seek_points[k];
+                }
+                PROGRESS.add(p.length);
+            }
+            if ((uint64_t)(chunk.bits - skip) != end[i] - start[i]) {
+                cout << node.path << " has changed during compression" << endl << "Process has been terminated" << endl;
+                exit(1);
+            }
+            const size_t size = chunk.bytes.size();
+            const size_t from = skip ? 1 : 0;
+            const size_t to   = chunk.bits % 8 ? size - 1 : size;
+            if (skip) first[i] = chunk.bytes[0];
+            if (chunk.bits % 8) last[i] = chunk.bytes[size - 1];
+            if (from < to) {
+                clocks[pool.worker()].start();
+                if (!pwrite_all(fd, chunk.bytes.data() + from, to - from, byte + from)) failed = true;
+                clocks[pool.worker()].stop(PHASE_WRITE);
+                PHASES.add_bytes(PHASE_WRITE, to - from);
+            }
+        });
+    }
+    pool.wait();
+    for (const thread_clock& clock : clocks) {
+        PHASES.add_thread_time(clock, PHASE_ENCODE);
+    }
+
+    // Shared bytes in the order of the file: the pending bits of the header, then the partial first and last
+    // byte of every piece, the bits of every piece are zero outside of its own
+    PHASES.enter(PHASE_MERGE);
+    off_t         shared_at = start[0] / 8;
+    unsigned char shared    = current_bit_count ? current_byte << (8 - current_bit_count) : 0;
+    bool          pending   = current_bit_count;
+    auto          share     = [&](off_t at, unsigned char value) {
+        if (pending && at != shared_at && !pwrite_all(fd, &shared, 1, shared_at)) failed = true;
+        if (!pending || at != shared_at) shared = 0;
+        shared_at = at;
+        shared |= value;
+        pending = true;
+    };
+    for (long int i = 0; i < count; i++) {
+        if (start[i] % 8) share(start[i] / 8, first[i]);
+        if (end[i] % 8) share(end[i] / 8, last[i]);
+    }
+    if (pending && !pwrite_all(fd, &shared, 1, shared_at)) failed = true;
+    if (failed) {
+        cout << "An error has occurred" << endl << "Process has been aborted" << endl;
+        exit(1);
+    }
+    current_byte      = 0;
+    current_bit_count = 0;
+    fseek(compressed_fp, (start[count] + 7) / 8, SEEK_SET);
 }
 
-int this_is_not_a_folder(char* path) {
-    DIR* temp = opendir(path);
-    if (temp) {
-        closedir(temp);
-        return 0;
+// Checksums of the blocks of a stored file, taken from its mapping by an encoding thread
+void checksum_stored(tree_node& node, const input_file& input) {
+    for (size_t done = 0; done < input.size; done += CHECKSUM_BLOCK_SIZE) {
+        node.checksums.push_back(crc32c(input.data + done, min(CHECKSUM_BLOCK_SIZE, input.size - done)));
     }
-    return 1;
 }
 
-long int size_of_the_file(char* path) {
-    long int size;
-    FILE*    fp = fopen(path, "rb");
-    fseek(fp, 0, SEEK_END);
-    size = ftell(fp);
-    fclose(fp);
-    return size;
+// Stored files skip the translation: the pending bits are padded to a whole byte and the bytes of the file
+// are copied to the compressed file by the kernel (see copy_input in input_file.hpp)
+void write_stored_content(const tree_node& node, unsigned char& current_byte, int& current_bit_count, FILE* compressed_fp) {
+    file_use          use;
+    const input_file& input = map_file(node, use);
+    if (current_bit_count) {
+        current_byte <<= 8 - current_bit_count;
+        fwrite(&current_byte, 1, 1, compressed_fp);
+        current_bit_count = 0;
+    }
+    if (!copy_input(input, node.path.c_str(), compressed_fp)) {
+        cout << "An error has occurred" << endl << "Process has been aborted" << endl;
+        exit(1);
+    }
+    PHASES.add_bytes(PHASE_WRITE, input.size);
+    PROGRESS.add(input.size);
 }
 
-void count_in_folder(string path, long int* local_number, long int& local_total_size, long int& local_total_bits) {
-    FILE* original_fp;
-    path += '/';
-    DIR *  dir = opendir(&path[0]), *next_dir;
-    string next_path;
-    local_total_size += 4096;
-    local_total_bits += 16;   // for file_count
+// Lists the entries of a folder and walks its subfolders as new tasks.
+// The type and size come from one fstatat per entry (which follows symbolic links like opendir and open do)
+void walk_folder(tree_node& folder, task_pool& pool) {
+    DIR* dir = opendir(folder.path.c_str());
+    if (!dir) {
+        cout << folder.path << " folder could not be read" << endl << "Process has been terminated" << endl;
+        exit(1);
+    }
     struct dirent* current;
     while ((current = readdir(dir))) {
         if (current->d_name[0] == '.') {
             if (current->d_name[1] == 0) continue;
             if (current->d_name[1] == '.' && current->d_name[2] == 0) continue;
         }
-        local_total_bits += 9;
-
-        for (char* c = current->d_name; *c; c++) {   // counting usage frequency of bytes on the file name (or folder name)
-            local_number[(unsigned char)(*c)]++;
+        tree_node child;
+        child.name = current->d_name;
+        child.path = folder.path + '/' + child.name;
+        struct stat st;
+        if (fstatat(dirfd(dir), current->d_name, &st, 0)) {
+            cout << child.path << " file could not be read" << endl << "Process has been terminated" << endl;
+            exit(1);
         }
+        child.folder = S_ISDIR(st.st_mode);
+        child.size   = child.folder ? 0 : st.st_size;
+        folder.children.push_back(child);
+    }
+    closedir(dir);
 
-        next_path = path + current->d_name;
+    // children is not resized any more, so the tasks can keep pointers into it
+    for (tree_node& child : folder.children) {
+        if (!child.folder) continue;
+        pool.spawn([&child, &pool] { walk_folder(child, pool); });
+    }
+}
 
-        if ((next_dir = opendir(&next_path[0]))) {
-            closedir(next_dir);
-            count_in_folder(next_path, local_number, local_total_size, local_total_bits);
-        } else {
-            long int      size;
-            unsigned char x;
-            local_total_size += size = size_of_the_file(&next_path[0]);
-            local_total_bits += 64;
+// Appends node and everything below it in the order of the records
+void flatten(tree_node& node, vector<tree_node*>& records) {
+    records.push_back(&node);
+    for (tree_node& child : node.children) {
+        flatten(child, records);
+    }
+}
 
-            original_fp = fopen(&next_path[0], "rb");
+// Opens an input file for both passes (see input_file.hpp), the program cannot continue without it
+void open_the_file(input_file& input, const char* path) {
+    if (!input.open(path)) {
+        cout << path << " file could not be read" << endl << "Process has been terminated" << endl;
+        exit(1);
+    }
+}
 
-            for (long int j = 0; j < size; j++) {   // counting usage frequency of bytes inside the file
-                fread(&x, 1, 1, original_fp);
-                local_number[x]++;
-            }
-            fclose(original_fp);
-        }
+// Contents of a file record for one task: arguments are already open, a file inside a folder that several tasks
+// of the pass read is mapped once for all of them (share_mapping), other files are mapped into use.
+// The size was written in the header before the content is read, so a file that changed since the walk is an error
+const input_file& map_file(const tree_node& node, file_use& use) {
+    if (node.input) return *node.input;
+    input_file* input = &use.own;
+    if (node.mapping) {
+        use.shared = node.mapping.get();
+        input      = &use.shared->input;
+        call_once(use.shared->opened, [&] { open_the_file(*input, node.path.c_str()); });
+    } else {
+        open_the_file(*input, node.path.c_str());
     }
-    closedir(dir);
-}
\ No newline at end of file
+    if ((long int)input->size != node.size) {
+        cout << node.path << " has changed during compression" << endl << "Process has been terminated" << endl;
+        exit(1);
+    }
+    return *input;
+}
+
+// Called before a pass: the file of node is read by users tasks of the pass, files inside folders that are read by
+// more than one get a mapping they share (the one of the previous pass is dropped)
+void share_mapping(tree_node& node, long int users) {
+    node.mapping.reset();
+    if (!node.input && users > 1) node.mapping = make_shared<file_mapping>(users);
+}
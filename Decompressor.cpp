@@ -0,0 +1,554 @@
+#include "archive_format.hpp"
+#include "archive_reader.hpp"
+#include "bit_reader.hpp"
+#include "cli_options.hpp"
+#include "code_table.hpp"
+#include "crc32c.hpp"
+#include "huffman.hpp"
+#include "stream_format.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <omp.h>
+#include <string>
+#include <sys/stat.h>
+#include <vector>
+
+using namespace std;
+
+// Reads archives created by Compressor.cpp, the layout of the compressed file is documented at the top of that file.
+// The translation info (third part) is turned into a decode_table so every byte of the names and the contents
+// is found with one or two table lookups instead of walking the Huffman tree bit by bit.
+
+bool              read_code_lengths(bit_reader&, int, vector<decode_table::code>&);
+bool              read_code_words(bit_reader&, int, vector<decode_table::code>&);
+unsigned long int read_varint(bit_reader&);
+int               read_file_count(bit_reader&, int);
+unsigned long int read_file_size(bit_reader&, int);
+string            read_file_name(bit_reader&, const decode_table&, int);
+bool              safe_path(const string&);
+void              make_parent_folders(const string&);
+void              translate_file_content(const string&, long int, bool, bit_reader&, const decode_table&);
+void              translate_folder(const string&, bit_reader&, const decode_table&, int);
+void              list_index(const vector<index_entry>&);
+int               extract_paths(char**, int, const vector<index_entry>&, FILE*, const decode_table&);
+int               verify_archive(const char*, const vector<index_entry>&, const decode_table&);
+int               extract_stream(FILE*, FILE*);
+
+int main(int argc, char* argv[]) {
+    cli_options options;
+    if (!parse_options(argc, argv, options) ||
+        (options.stream ? argc != 1 : argc < 2 || ((options.list || options.verify) && argc != 2) || (options.range && argc != 3))) {
+        cout << "Missing file name" << endl
+             << "try './extract {{file_name}}'" << endl
+             << "or './extract {{file_name}} {{path}}...' for some files or folders of the archive only" << endl
+             << "or './extract --list {{file_name}}' for the files and folders inside it" << endl
+             << "or './extract --range={{offset}}:{{length}} {{file_name}} {{path}}' for a part of one file on the standard output" << endl
+             << "or './extract --verify {{file_name}}' to check the archive on all cores without writing anything" << endl
+             << "or './extract --stream < input > output' for the output of './archive --stream'" << endl
+             << "options: -p {{password}} for protected archives, -n (fail instead of asking for a password)" << endl;
+        return 0;
+    }
+    if (options.stream) {
+        return extract_stream(stdin, stdout);
+    }
+
+    FILE* compressed_fp = fopen(argv[1], "rb");
+    if (!compressed_fp) {
+        cout << argv[1] << " file does not exist" << endl << "Process has been terminated" << endl;
+        return 0;
+    }
+
+    // Read zeroth: the format version (see archive_format.hpp), version 1 files start with letter_count
+    int           version = 1;
+    unsigned char magic[sizeof(FORMAT_MAGIC)];
+    if (fread(magic, 1, sizeof(magic), compressed_fp) == sizeof(magic) && !memcmp(magic, FORMAT_MAGIC, sizeof(magic))) {
+        version = fgetc(compressed_fp);
+    } else {
+        rewind(compressed_fp);
+    }
+    if (version != 1 && version != FORMAT_VERSION) {
+        cout << argv[1] << " was created by a newer version of archive" << endl << "Process has been terminated" << endl;
+        fclose(compressed_fp);
+        return 1;
+    }
+
+    // Read first: letter_count (a varint, in version 1 one byte where 256 unique bytes wraps around to 0)
+    int letter_count = 0;
+    if (version == 1) {
+        letter_count = fgetc(compressed_fp);
+        if (letter_count == 0) letter_count = 256;
+    } else {
+        for (int shift = 0, c; shift < 14; shift += 7) {
+            if ((c = fgetc(compressed_fp)) == EOF) break;
+            letter_count |= (c & 0x7F) << shift;
+            if (!(c & 0x80)) break;
+        }
+    }
+    if (letter_count <= 0 || letter_count > 256) {
+        cout << argv[1] << " is not a compressed file" << endl << "Process has been terminated" << endl;
+        fclose(compressed_fp);
+        return 1;
+    }
+
+    // Read second: password
+    int password_length = fgetc(compressed_fp);
+    if (password_length > 0) {
+        string password(password_length, 0);
+        if (fread(&password[0], 1, password_length, compressed_fp) != (size_t)password_length) {
+            cout << argv[1] << " is not a compressed file" << endl << "Process has been terminated" << endl;
+            fclose(compressed_fp);
+            return 1;
+        }
+        string entered = options.password;
+        if (options.ask_password) {
+            cout << "Enter your password: ";
+            cin >> entered;
+        } else if (!options.has_password) {
+            cout << argv[1] << " is protected with a password, use -p {{password}}" << endl << "Process has been terminated" << endl;
+            fclose(compressed_fp);
+            return 1;
+        }
+        if (entered != password) {
+            cout << "Wrong password" << endl << "Process has been terminated" << endl;
+            fclose(compressed_fp);
+            return 0;
+        }
+    }
+
+    // --list and paths: the entries come from the index (ninth part), the records before them are not read
+    vector<index_entry> index;
+    if ((options.list || options.verify || argc > 2) && !read_index(fileno(compressed_fp), version, index)) {
+        cout << argv[1] << " has no index (it was created by an older version), extract it whole" << endl
+             << "Process has been terminated" << endl;
+        fclose(compressed_fp);
+        return 1;
+    }
+    if (options.list) {
+        list_index(index);
+        fclose(compressed_fp);
+        return 0;
+    }
+
+    // Read third: every unique byte and the length of its transformation.
+    // Transformations are canonical, so code_table rebuilds them from the lengths exactly like the compressor did.
+    // Archives written before the codes were canonical have no version either, but they store every transformation
+    // after its length (see read_code_words). Read as lengths only, their third part does not make a complete code,
+    // so it is read again the old way
+    const off_t                third = ftello(compressed_fp);
+    vector<decode_table::code> table_codes;
+    bool                       canonical;
+    {
+        bit_reader probe(compressed_fp);
+        canonical = read_code_lengths(probe, letter_count, table_codes);
+    }
+    fseeko(compressed_fp, third, SEEK_SET);
+    bit_reader in(compressed_fp);
+    if (canonical ? !read_code_lengths(in, letter_count, table_codes) : version != 1 || !read_code_words(in, letter_count, table_codes)) {
+        cout << argv[1] << " has an unsupported archive format" << endl << "Process has been terminated" << endl;
+        fclose(compressed_fp);
+        return 1;
+    }
+    decode_table table;
+    table.build(table_codes);
+
+    if (options.verify) {
+        fclose(compressed_fp);
+        return verify_archive(argv[1], index, table);
+    }
+    if (options.range) {
+        const index_entry* entry = find_entry(index, argv[2]);
+        if (!entry || (entry->flags & INDEX_FOLDER)) {
+            cerr << argv[2] << " is not a file in the archive" << endl;
+            fclose(compressed_fp);
+            return 1;
+        }
+        vector<unsigned char> bytes;
+        bool                  read = read_range(compressed_fp, table, *entry, options.range_offset, options.range_length, bytes);
+        fclose(compressed_fp);
+        if (!read) {
+            cerr << "An error has occurred" << endl << "Process has been aborted" << endl;
+            return 1;
+        }
+        fwrite(bytes.data(), 1, bytes.size(), stdout);
+        return 0;
+    }
+
+    // Paths are checked before anything is written: an absolute path or a ".." segment in a crafted archive would write
+    // outside of the working folder. Archives without an index are checked record by record (see translate_folder)
+    if (argc == 2) read_index(fileno(compressed_fp), version, index);
+    for (const index_entry& entry : index) {
+        if (!safe_path(entry.path)) {
+            cout << argv[1] << " contains the unsafe path \"" << entry.path << "\", nothing has been extracted" << endl
+                 << "Process has been terminated" << endl;
+            fclose(compressed_fp);
+            return 1;
+        }
+    }
+    if (argc > 2) {
+        int result = extract_paths(argv + 2, argc - 2, index, compressed_fp, table);
+        fclose(compressed_fp);
+        if (!result) cout << "Decompression is complete" << endl;
+        return result;
+    }
+
+    // Read fourth to eighth for the files and folders that were given as arguments
+    translate_folder("", in, table, version);
+
+    fclose(compressed_fp);
+    cout << "Decompression is complete" << endl;
+    return 0;
+}
+
+// Reads the unique bytes and the lengths of their transformations and makes the canonical code words.
+// Returns false unless every byte appears once and the lengths make a complete code (every code the compressors
+// build is complete, a single unique byte gets no bits at all)
+bool read_code_lengths(bit_reader& in, int letter_count, vector<decode_table::code>& codes) {
+    unsigned char lengths[256] = {0};
+    bool          seen[256]    = {false};
+    uint32_t      kraft        = 0;   // in units of 2^-MAX_CODE_LENGTH_LIMIT
+    codes.resize(letter_count);
+    for (decode_table::code& c : codes) {
+        c.character = in.read(8);
+        c.length    = in.read(8);
+        if (seen[c.character] || c.length > MAX_CODE_LENGTH_LIMIT || (c.length == 0) != (letter_count == 1)) return false;
+        seen[c.character]     = true;
+        lengths[c.character] = c.length;
+        if (c.length) kraft += 1u << (MAX_CODE_LENGTH_LIMIT - c.length);
+    }
+    if (letter_count > 1 && kraft != 1u << MAX_CODE_LENGTH_LIMIT) return false;
+    code_table table;
+    table.assign_canonical(lengths);
+    for (decode_table::code& c : codes) {
+        c.word = table.code[c.character];
+    }
+    return true;
+}
+
+// Third part of the first archives: every unique byte, the length of its transformation (up to 255 bits, the
+// Huffman tree was not length limited) and the transformation itself. Returns false unless every byte appears
+// once and no transformation is the start of another one. Transformations longer than 64 bits cannot be decoded
+bool read_code_words(bit_reader& in, int letter_count, vector<decode_table::code>& codes) {
+    bool seen[256] = {false};
+    codes.resize(letter_count);
+    for (decode_table::code& c : codes) {
+        c.character = in.read(8);
+        c.length    = in.read(8);
+        c.word      = 0;
+        if (seen[c.character] || c.length > 64 || (c.length == 0) != (letter_count == 1)) return false;
+        seen[c.character] = true;
+        for (int left = c.length; left > 0; left -= 32) {
+            int n  = left < 32 ? left : 32;
+            c.word = (c.word << n) | in.read(n);
+        }
+    }
+    // sorted by their bits, a transformation that starts another one comes right before it or before another one it starts
+    vector<decode_table::code> sorted(codes);
+    auto                       aligned = [](const decode_table::code& c) { return c.length ? c.word << (64 - c.length) : 0; };
+    sort(sorted.begin(), sorted.end(), [&](const decode_table::code& a, const decode_table::code& b) {
+        return aligned(a) != aligned(b) ? aligned(a) < aligned(b) : a.length < b.length;
+    });
+    for (size_t i = 1; i < sorted.size(); i++) {
+        const decode_table::code &a = sorted[i - 1], &b = sorted[i];
+        if (a.length <= b.length && b.word >> (b.length - a.length) == a.word) return false;
+    }
+    return true;
+}
+
+// Reverse of encode_varint (archive_format.hpp), at most MAX_VARINT_BYTES bytes are read
+unsigned long int read_varint(bit_reader& in) {
+    unsigned long int value = 0;
+    for (int shift = 0; shift < 7 * MAX_VARINT_BYTES; shift += 7) {
+        unsigned long int byte = in.read(8);
+        value |= (byte & 0x7F) << shift;
+        if (!(byte & 0x80)) break;
+    }
+    return value;
+}
+
+// Reverse of write_file_count: a varint, or 2 bytes with the low byte first in version 1
+int read_file_count(bit_reader& in, int version) {
+    if (version > 1) return read_varint(in);
+    int low  = in.read(8);
+    int high = in.read(8);
+    return low + 256 * high;
+}
+
+// Reverse of write_file_size: a varint, or 8 bytes with the least significant byte first in version 1
+// (STORED_FILE may be set, see archive_format.hpp)
+unsigned long int read_file_size(bit_reader& in, int version) {
+    if (version > 1) return read_varint(in);
+    unsigned long int size = 0;
+    for (int i = 0; i < 8; i++) {
+        size |= (unsigned long int)in.read(8) << (8 * i);
+    }
+    return size;
+}
+
+// Reads the length of the name (a varint, one byte in version 1) and the translated name of a file or a folder
+string read_file_name(bit_reader& in, const decode_table& table, int version) {
+    size_t length = version > 1 ? read_varint(in) : in.read(8);
+    string name(length, 0);
+    table.decode(in, (unsigned char*)&name[0], length);
+    return name;
+}
+
+// A path may be written to when it stays inside the working folder: it is not empty, not absolute and has no ".."
+// segment (archive stores the arguments as they were given, so their names may contain folders)
+bool safe_path(const string& path) {
+    if (path.empty() || path[0] == '/') return false;
+    for (size_t start = 0, end; start <= path.size(); start = end + 1) {
+        end = path.find('/', start);
+        if (end == string::npos) end = path.size();
+        if (path.compare(start, end - start, "..") == 0) return false;
+    }
+    return true;
+}
+
+// Names given on the command line may contain folders that do not exist yet
+void make_parent_folders(const string& path) {
+    for (size_t i = path.find('/', 1); i != string::npos; i = path.find('/', i + 1)) {
+        mkdir(path.substr(0, i).c_str(), 0755);
+    }
+}
+
+// Decodes 'size' bytes of content and writes them to 'path', the bytes of stored files are copied as they are
+void translate_file_content(const string& path, long int size, bool stored, bit_reader& in, const decode_table& table) {
+    make_parent_folders(path);
+    FILE* original_fp = fopen(path.c_str(), "wb");
+    if (!original_fp) {
+        cout << "Cannot create " << path << endl << "Process has been aborted" << endl;
+        exit(2);
+    }
+
+    vector<unsigned char> buffer(256 * 1024);
+    if (stored) in.align();
+    for (long int remaining = size; remaining > 0;) {
+        size_t chunk = remaining < (long int)buffer.size() ? remaining : buffer.size();
+        if (stored) {
+            in.read_bytes(buffer.data(), chunk);
+        } else {
+            table.decode(in, buffer.data(), chunk);
+        }
+        fwrite(buffer.data(), 1, chunk, original_fp);
+        remaining -= chunk;
+    }
+    fclose(original_fp);
+}
+
+// Reads fourth (file count) and then fifth to eighth for every file and folder inside 'path'.
+// Every name is checked before its file or folder is created: only the arguments (path is empty) may contain folders
+void translate_folder(const string& path, bit_reader& in, const decode_table& table, int version) {
+    int file_count = read_file_count(in, version);
+    for (int i = 0; i < file_count; i++) {
+        bool              file = in.read(1);
+        unsigned long int size = file ? read_file_size(in, version) : 0;
+        string            name = read_file_name(in, table, version);
+        if (!safe_path(name) || (!path.empty() && (name.find('/') != string::npos || name == "."))) {
+            cout << "The archive contains the unsafe path \"" << path + name << "\"" << endl << "Process has been aborted" << endl;
+            exit(2);
+        }
+        name = path + name;
+        if (file) {
+            translate_file_content(name, size & ~STORED_FILE, size & STORED_FILE, in, table);
+        } else {
+            make_parent_folders(name);
+            mkdir(name.c_str(), 0755);
+            translate_folder(name + '/', in, table, version);
+        }
+    }
+}
+
+// One line per entry of the index: the size and the path, folders end with '/'
+void list_index(const vector<index_entry>& index) {
+    for (const index_entry& entry : index) {
+        if (entry.flags & INDEX_FOLDER) {
+            printf("%14s  %s/\n", "", entry.path.c_str());
+        } else {
+            printf("%14llu  %s\n", (unsigned long long)entry.size, entry.path.c_str());
+        }
+    }
+}
+
+// Extracts the entries of the index that are one of the paths or inside one of them. Every file is decoded
+// from the bit offset of its content, so the time does not depend on what comes before it in the archive
+int extract_paths(char** paths, int path_count, const vector<index_entry>& index, FILE* compressed_fp, const decode_table& table) {
+    int result = 0;
+    for (int i = 0; i < path_count; i++) {
+        string path = paths[i];
+        while (path.size() > 1 && path.back() == '/') path.pop_back();
+        bool found = false;
+        for (const index_entry& entry : index) {
+            if (entry.path.compare(0, path.size(), path) ||
+                (entry.path.size() > path.size() && entry.path[path.size()] != '/' && path.back() != '/')) {
+                continue;
+            }
+            found = true;
+            if (entry.flags & INDEX_FOLDER) {
+                make_parent_folders(entry.path);
+                mkdir(entry.path.c_str(), 0755);
+                continue;
+            }
+            if (fseeko(compressed_fp, entry.offset / 8, SEEK_SET)) {
+                cout << "An error has occurred" << endl << "Process has been aborted" << endl;
+                return 1;
+            }
+            bit_reader in(compressed_fp);
+            if (entry.offset % 8) in.read(entry.offset % 8);
+            translate_file_content(entry.path, entry.size, entry.flags & INDEX_STORED, in, table);
+        }
+        if (!found) {
+            cout << paths[i] << " is not in the archive" << endl;
+            result = 1;
+        }
+    }
+    return result;
+}
+
+// Checksum blocks checked by one task of verify_archive: the blocks of a file starting at first_block, decoding starts
+// at start_bit, which is the code of input byte start_offset (the start of the content or a seek point)
+struct verify_task {
+    const index_entry* entry;
+    uint64_t           start_offset;
+    uint64_t           start_bit;
+    uint64_t           first_block;
+    uint64_t           last_block;   // exclusive
+};
+
+// Decodes every block of every file in the index and compares its CRC32C with the index, nothing is written.
+// Blocks are checked on all threads: one task per seek segment of a file (one per checksum block by default) that checks
+// the blocks starting in it, one task per block of a stored file. Returns 1 if a block does not match
+int verify_archive(const char* archive, const vector<index_entry>& index, const decode_table& table) {
+    vector<verify_task> tasks;
+    long int            unchecked = 0, blocks = 0;
+    for (const index_entry& entry : index) {
+        if ((entry.flags & INDEX_FOLDER) || !entry.size) continue;
+        if (entry.checksums.empty()) {
+            unchecked++;
+            continue;
+        }
+        const uint64_t block = entry.checksum_block;
+        blocks += entry.checksums.size();
+        if (entry.flags & INDEX_STORED) {
+            for (uint64_t k = 0; k < entry.checksums.size(); k++) {
+                tasks.push_back(verify_task{&entry, k * block, entry.offset + 8 * k * block, k, k + 1});
+            }
+            continue;
+        }
+        for (size_t j = 0; j <= entry.seek_points.size(); j++) {
+            const uint64_t start = j * entry.seek_interval;
+            const uint64_t end   = j < entry.seek_points.size() ? (j + 1) * entry.seek_interval : entry.size;
+            const uint64_t first = (start + block - 1) / block, last = (end + block - 1) / block;
+            if (first < last) tasks.push_back(verify_task{&entry, start, j ? entry.seek_points[j - 1] : entry.offset, first, last});
+        }
+    }
+
+    vector<vector<uint64_t>> failed(tasks.size());   // blocks that do not match, for every task
+#pragma omp parallel
+    {
+        FILE*                 fp = fopen(archive, "rb");
+        vector<unsigned char> buffer;
+#pragma omp for schedule(dynamic)
+        for (long int t = 0; t < (long int)tasks.size(); t++) {
+            const verify_task& task  = tasks[t];
+            const index_entry& entry = *task.entry;
+            const uint64_t     block = entry.checksum_block;
+            if (!fp || fseeko(fp, task.start_bit / 8, SEEK_SET)) {
+                for (uint64_t k = task.first_block; k < task.last_block; k++) failed[t].push_back(k);
+                continue;
+            }
+            if (entry.flags & INDEX_STORED) {
+                buffer.resize(min(block, entry.size - task.start_offset));
+                if (fread(buffer.data(), 1, buffer.size(), fp) != buffer.size() ||
+                    crc32c(buffer.data(), buffer.size()) != entry.checksums[task.first_block]) {
+                    failed[t].push_back(task.first_block);
+                }
+                continue;
+            }
+            bit_reader in(fp);
+            if (task.start_bit % 8) in.read(task.start_bit % 8);
+            buffer.resize(block);
+            for (uint64_t skip = task.first_block * block - task.start_offset; skip;) {   // up to the first block
+                size_t n = min<uint64_t>(skip, block);
+                table.decode(in, buffer.data(), n);
+                skip -= n;
+            }
+            for (uint64_t k = task.first_block; k < task.last_block; k++) {
+                size_t n = min(block, entry.size - k * block);
+                table.decode(in, buffer.data(), n);
+                if (crc32c(buffer.data(), n) != entry.checksums[k]) failed[t].push_back(k);
+            }
+        }
+        if (fp) fclose(fp);
+    }
+
+    long int bad = 0;
+    for (size_t t = 0; t < tasks.size(); t++) {
+        for (uint64_t k : failed[t]) {
+            const index_entry& entry = *tasks[t].entry;
+            cout << entry.path << ": bytes " << k * entry.checksum_block << " to "
+                 << min(entry.size, (k + 1) * entry.checksum_block) - 1 << " do not match their checksum" << endl;
+            bad++;
+        }
+    }
+    if (unchecked) cout << unchecked << " files have no checksums (created by an older version)" << endl;
+    if (bad) {
+        cout << bad << " of " << blocks << " blocks are corrupted" << endl;
+        return 1;
+    }
+    cout << "All " << blocks << " blocks are correct" << endl;
+    return 0;
+}
+
+// Streaming mode: reverse of compress_stream in Compressor.cpp, one block at a time from 'in' to 'out'
+int extract_stream(FILE* in, FILE* out) {
+    auto failed = []() {
+        cerr << "An error has occurred" << endl << "Process has been aborted" << endl;
+        return 1;
+    };
+
+    // the fields of every block are read into one buffer, which the block codec of libhuffman parses and decodes
+    vector<unsigned char> raw, original;
+    huffman::block_info   block;
+    auto                  read_more = [&](size_t n) {
+        size_t used = raw.size();
+        raw.resize(used + n);
+        return fread(raw.data() + used, 1, n, in) == n;
+    };
+    while (true) {
+        raw.clear();
+        if (!read_more(4)) return failed();
+        uint32_t size = huffman::load_uint32(raw.data());
+        if (!size) break;   // end of the stream
+        if (size & STREAM_STORED) {
+            if ((size & ~STREAM_STORED) > STREAM_BLOCK_SIZE || !read_more(size & ~STREAM_STORED)) return failed();
+            if (huffman::parse_block(raw.data(), raw.size(), block) != raw.size()) return failed();
+            fwrite(block.encoded, 1, block.size, out);
+            continue;
+        }
+
+        if (!read_more(1)) return failed();
+        int letter_count = raw[4] ? raw[4] : 256;
+        if (!read_more(2 * letter_count)) return failed();
+        int streams = 1;
+        if (size & STREAM_INTERLEAVED) {
+            if (!read_more(1)) return failed();
+            streams = raw.back();
+        }
+        size_t sizes_at = raw.size();
+        if (streams < 1 || streams > MAX_STREAMS || !read_more(4 * streams)) return failed();
+        uint32_t encoded_size = huffman::load_uint32(raw.data() + sizes_at);
+        if (encoded_size > 2 * STREAM_BLOCK_SIZE || !read_more(encoded_size)) return failed();
+
+        if (huffman::parse_block(raw.data(), raw.size(), block) != raw.size()) return failed();
+        original.resize(block.size);
+        if (!huffman::decode_block(block, original.data())) return failed();
+        fwrite(original.data(), 1, block.size, out);
+    }
+    fflush(out);
+    if (ferror(out)) return failed();
+    return 0;
+}
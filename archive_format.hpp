@@ -0,0 +1,207 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+// Constants of the compressed file written by archive and modified_archive (the layout is documented in
+// Compressor.cpp) that extract has to know as well.
+
+// Version 2 of the layout starts with FORMAT_MAGIC and the version byte, and its counts and lengths are varints:
+// letter_count (first, 1 to 256), file_count (fourth), size (sixth, STORED_FILE included), the name length (7.1)
+// and the path length of every index entry, so folders of more than 65535 entries, names (arguments) longer than
+// 255 bytes and paths of any length fit.
+// Version 1 files have no magic: they start with letter_count (256 written as 0) and the password length,
+// which is never above 100, so a version 1 file cannot start with FORMAT_MAGIC. Their counts are 2 bytes
+// (low byte first), sizes 8 bytes (least significant first) and name lengths 1 byte.
+const unsigned char FORMAT_MAGIC[4]  = {0xFF, 0xFF, 'H', 'F'};
+const int           FORMAT_VERSION   = 2;
+const int           MAX_VARINT_BYTES = 10;
+
+// Unsigned LEB128: 7 bits per byte, least significant group first, the high bit is set on every byte but the last.
+// Fills out and returns the number of bytes
+inline int encode_varint(uint64_t value, unsigned char* out) {
+    int n = 0;
+    for (; value >= 0x80; value >>= 7) out[n++] = (value & 0x7F) | 0x80;
+    out[n++] = value;
+    return n;
+}
+
+inline int varint_size(uint64_t value) {
+    int n = 1;
+    for (; value >= 0x80; value >>= 7) n++;
+    return n;
+}
+
+// Set in the sixth part (size) of a file whose content is stored as it is instead of being transformed.
+// The content of a stored file starts at the next byte boundary after the name, the bits in between are zeros.
+// File sizes are far below 2^63, so archives without stored files never have this bit set.
+const uint64_t STORED_FILE = 1ULL << 63;
+
+// Index (ninth part): written after the padded last byte of the records, so extract can list the archive or
+// decode one file without reading the records before it. Numbers are little endian.
+//
+//   every file and folder, in the order of the records:
+//     flags (1 byte)          INDEX_FOLDER, INDEX_STORED, INDEX_SEEK, INDEX_CHECKSUM
+//     size (8 bytes)          size of the file, 0 for folders
+//     offset (8 bytes)        bit offset of the content (eighth part) from the start of the compressed file,
+//                             a multiple of 8 for stored files, 0 for folders
+//     path length (varint)    2 bytes (low byte first) in version 1 archives
+//     path (bytes)            path the entry is extracted to, not transformed
+//     with INDEX_SEEK (files larger than the --seek interval, 1MB by default, see cli_options.hpp):
+//       interval (8 bytes)    input bytes between two seek points
+//       count (8 bytes)       number of seek points
+//       points (8 bytes each) bit offset of the code of input byte k * interval (k = 1..count) of the file, the
+//                             codes of a file do not depend on what came before, so decoding can start there
+//     with INDEX_CHECKSUM (files that are not empty):
+//       block size (8 bytes)  input bytes of a checksum block
+//       checksums (4 bytes)   CRC32C (see crc32c.hpp) of every block of the file, ceil(size / block size) of them
+//   trailer (INDEX_TRAILER_SIZE bytes):
+//     size (8 bytes)          bytes of the entries
+//     count (8 bytes)         number of entries
+//     magic (8 bytes)         INDEX_MAGIC
+//
+// Archives written before the index end with the last record, older versions of extract never read past it.
+const char          INDEX_MAGIC[8]      = {'H', 'U', 'F', 'I', 'N', 'D', 'E', 'X'};
+const size_t        INDEX_ENTRY_SIZE    = 17;   // without the path and its length
+const size_t        INDEX_TRAILER_SIZE  = 24;
+const size_t        INDEX_TAIL_READ     = 64 * 1024;   // the first read at the end of the file, holds most indexes whole
+const unsigned char INDEX_FOLDER        = 1;
+const unsigned char INDEX_STORED        = 2;
+const unsigned char INDEX_SEEK          = 4;
+const unsigned char INDEX_CHECKSUM      = 8;
+const uint64_t      CHECKSUM_BLOCK_SIZE = 1024 * 1024;   // written by the compressors, readers use the size in the index
+
+struct index_entry {
+    std::string           path;
+    uint64_t              size           = 0;
+    uint64_t              offset         = 0;
+    unsigned char         flags          = 0;
+    uint64_t              seek_interval  = 0;
+    std::vector<uint64_t> seek_points;   // INDEX_SEEK is written when there are any
+    uint64_t              checksum_block = CHECKSUM_BLOCK_SIZE;
+    std::vector<uint32_t> checksums;   // INDEX_CHECKSUM is written when there are any
+};
+
+inline void append_uint64(std::vector<unsigned char>& out, uint64_t value) {
+    for (int i = 0; i < 8; i++) out.push_back(value >> (8 * i));
+}
+
+// bytes of the index entry of a path (without seek points and checksums), for the size estimates of the compressors
+inline size_t index_entry_size(size_t path_length) {
+    return INDEX_ENTRY_SIZE + varint_size(path_length) + path_length;
+}
+
+inline uint64_t load_uint64(const unsigned char* p) {
+    uint64_t value = 0;
+    for (int i = 0; i < 8; i++) value |= (uint64_t)p[i] << (8 * i);
+    return value;
+}
+
+// Writes the entries and the trailer at the current position of fp, which has to be at a byte boundary
+inline bool write_index(FILE* fp, const std::vector<index_entry>& entries) {
+    std::vector<unsigned char> out;
+    for (const index_entry& entry : entries) {
+        out.push_back(entry.flags | (entry.seek_points.empty() ? 0 : INDEX_SEEK) | (entry.checksums.empty() ? 0 : INDEX_CHECKSUM));
+        append_uint64(out, entry.size);
+        append_uint64(out, entry.offset);
+        unsigned char length[MAX_VARINT_BYTES];
+        out.insert(out.end(), length, length + encode_varint(entry.path.size(), length));
+        out.insert(out.end(), entry.path.begin(), entry.path.end());
+        if (!entry.seek_points.empty()) {
+            append_uint64(out, entry.seek_interval);
+            append_uint64(out, entry.seek_points.size());
+            for (uint64_t point : entry.seek_points) append_uint64(out, point);
+        }
+        if (!entry.checksums.empty()) {
+            append_uint64(out, entry.checksum_block);
+            for (uint32_t checksum : entry.checksums) {
+                for (int i = 0; i < 4; i++) out.push_back(checksum >> (8 * i));
+            }
+        }
+    }
+    const uint64_t size = out.size();
+    append_uint64(out, size);
+    append_uint64(out, entries.size());
+    out.insert(out.end(), INDEX_MAGIC, INDEX_MAGIC + 8);
+    return fwrite(out.data(), 1, out.size(), fp) == out.size();
+}
+
+// Reads the index of the compressed file open as fd, written in the given format version. One pread of the last
+// INDEX_TAIL_READ bytes gets the trailer and usually the entries too, larger indexes take a second one.
+// Returns false if the file has no (valid) index
+inline bool read_index(int fd, int version, std::vector<index_entry>& entries) {
+    struct stat st;
+    if (fstat(fd, &st) || (uint64_t)st.st_size < INDEX_TRAILER_SIZE) return false;
+    const uint64_t             file_size = st.st_size;
+    uint64_t                   tail      = file_size < INDEX_TAIL_READ ? file_size : INDEX_TAIL_READ;
+    std::vector<unsigned char> buffer(tail);
+    if (pread(fd, buffer.data(), tail, file_size - tail) != (ssize_t)tail) return false;
+
+    const unsigned char* trailer = buffer.data() + tail - INDEX_TRAILER_SIZE;
+    if (memcmp(trailer + 16, INDEX_MAGIC, 8)) return false;
+    const uint64_t size  = load_uint64(trailer);
+    const uint64_t count = load_uint64(trailer + 8);
+    if (size > file_size - INDEX_TRAILER_SIZE || count > size / (INDEX_ENTRY_SIZE + 1)) return false;
+    if (size + INDEX_TRAILER_SIZE > tail) {
+        tail = size + INDEX_TRAILER_SIZE;
+        buffer.resize(tail);
+        if (pread(fd, buffer.data(), tail, file_size - tail) != (ssize_t)tail) return false;
+    }
+
+    const unsigned char* p   = buffer.data() + tail - INDEX_TRAILER_SIZE - size;
+    const unsigned char* end = p + size;
+    entries.resize(count);
+    for (index_entry& entry : entries) {
+        if (end - p < (long)INDEX_ENTRY_SIZE + 1) return false;
+        entry.flags  = p[0];
+        entry.size   = load_uint64(p + 1);
+        entry.offset = load_uint64(p + 9);
+        p += INDEX_ENTRY_SIZE;
+        uint64_t length = 0;
+        if (version == 1) {
+            if (end - p < 2) return false;
+            length = p[0] | p[1] << 8;
+            p += 2;
+        } else {
+            for (int shift = 0;; shift += 7) {
+                if (p == end || shift == 7 * MAX_VARINT_BYTES) return false;
+                length |= (uint64_t)(*p & 0x7F) << shift;
+                if (!(*p++ & 0x80)) break;
+            }
+        }
+        if ((uint64_t)(end - p) < length) return false;
+        entry.path.assign((const char*)p, length);
+        p += length;
+        if (entry.flags & INDEX_SEEK) {
+            if (end - p < 16) return false;
+            entry.seek_interval = load_uint64(p);
+            const uint64_t points = load_uint64(p + 8);
+            p += 16;
+            if (!entry.seek_interval || points > (uint64_t)(end - p) / 8 || points > entry.size / entry.seek_interval) return false;
+            entry.seek_points.resize(points);
+            for (uint64_t& point : entry.seek_points) {
+                point = load_uint64(p);
+                p += 8;
+            }
+        }
+        if (entry.flags & INDEX_CHECKSUM) {
+            if (end - p < 8) return false;
+            entry.checksum_block = load_uint64(p);
+            p += 8;
+            if (!entry.checksum_block) return false;
+            const uint64_t blocks = (entry.size + entry.checksum_block - 1) / entry.checksum_block;
+            if (blocks > (uint64_t)(end - p) / 4) return false;
+            entry.checksums.resize(blocks);
+            for (uint32_t& checksum : entry.checksums) {
+                checksum = p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+                p += 4;
+            }
+        }
+    }
+    return p == end;
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include "archive_format.hpp"
+#include "bit_reader.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// Random access to the files of a compressed file through its index (see archive_format.hpp).
+// The decode_table is the one of the third part, which has to be read (and the password checked) first.
+
+// Entry of the index with this path, NULL if there is none
+inline const index_entry* find_entry(const std::vector<index_entry>& index, const std::string& path) {
+    for (const index_entry& entry : index) {
+        if (entry.path == path) return &entry;
+    }
+    return NULL;
+}
+
+// Gives bytes [offset, offset + length) of the file of entry in out, fewer if the file ends before.
+// Decoding starts at the last seek point at or before offset (the start of the content without --seek), and the
+// bytes between the point and offset are decoded and dropped. Stored files are read from the right byte directly
+inline bool read_range(FILE* fp, const decode_table& table, const index_entry& entry, uint64_t offset, uint64_t length,
+                       std::vector<unsigned char>& out) {
+    out.clear();
+    if (entry.flags & INDEX_FOLDER) return false;
+    if (offset >= entry.size) return true;
+    out.resize(std::min(length, entry.size - offset));
+    if (entry.flags & INDEX_STORED) {
+        return !fseeko(fp, entry.offset / 8 + offset, SEEK_SET) && fread(out.data(), 1, out.size(), fp) == out.size();
+    }
+
+    const uint64_t point = entry.seek_interval ? std::min<uint64_t>(offset / entry.seek_interval, entry.seek_points.size()) : 0;
+    const uint64_t bit   = point ? entry.seek_points[point - 1] : entry.offset;
+    if (fseeko(fp, bit / 8, SEEK_SET)) return false;
+    bit_reader in(fp);
+    if (bit % 8) in.read(bit % 8);
+
+    std::vector<unsigned char> dropped(std::min<uint64_t>(offset - point * entry.seek_interval, 256 * 1024));
+    for (uint64_t skip = offset - point * entry.seek_interval; skip;) {
+        size_t n = std::min<uint64_t>(skip, dropped.size());
+        table.decode(in, dropped.data(), n);
+        skip -= n;
+    }
+    table.decode(in, out.data(), out.size());
+    return true;
+}
+
+// read_range for the file at path, false if the index has no such file
+inline bool read_range(FILE* fp, const decode_table& table, const std::vector<index_entry>& index, const std::string& path,
+                       uint64_t offset, uint64_t length, std::vector<unsigned char>& out) {
+    const index_entry* entry = find_entry(index, path);
+    return entry && read_range(fp, table, *entry, offset, length, out);
+}
@@ -0,0 +1,304 @@
+#include "bit_reader.hpp"
+#include "bit_writer.hpp"
+#include "code_table.hpp"
+#include "crc32c.hpp"
+#include "histogram.hpp"
+#include "stream_format.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <omp.h>
+#include <random>
+#include <sched.h>
+#include <string>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define BENCH_HAS_TSC 1
+#endif
+
+using namespace std;
+
+// Microbenchmark of the kernels behind the compressors (make bench).
+// Every kernel runs on buffers in memory, so file system and process startup noise is left out:
+//
+//   histogram   count_bytes (histogram.hpp)
+//   tree        code lengths, length limit and canonical codes for the histogram of every STREAM_BLOCK_SIZE block
+//               (huffman_code_lengths, limit_code_lengths and assign_canonical, as both compressors call them)
+//   encode      bit_writer::encode into memory (bit_writer.hpp)
+//   decode      decode_table::decode of the encoded buffer (bit_reader.hpp)
+//   decode4     decode_table::decode_interleaved<4> of the same bytes split into 4 streams (stream_format.hpp)
+//   crc32c      checksum of the blocks of the archive index (crc32c.hpp, SSE 4.2 when the CPU has it)
+//
+// The corpora are generated like data_generator.cpp does (random, repeating and skewed) with a fixed seed.
+// With -t N the buffer is split into N slices that N threads, each pinned to its own CPU, process at once.
+// Every kernel is run once to warm up and then -r times; the report gives the median and percentiles of the
+// wall time, the median throughput and the bytes per cycle of the median run (time stamp counter cycles,
+// which tick at the nominal frequency of the CPU).
+
+struct bench_options {
+    size_t size    = 16 * 1024 * 1024;
+    int    repeats = 15;
+    int    threads = 1;
+    string kernel  = "all";
+    string corpus  = "all";
+};
+
+// One buffer split into per thread slices plus everything the kernels need that is not measured
+struct corpus {
+    string                        name;
+    vector<unsigned char>         data;
+    vector<pair<size_t, size_t>>  slices;   // offset and length of the part of every thread
+    code_table                    codes;
+    decode_table                  table;
+    vector<vector<unsigned char>> encoded;            // encoded slices, input of decode
+    vector<vector<unsigned char>> interleaved;        // 4 encoded streams of every slice one after the other, input of decode4
+    vector<vector<size_t>>        stream_sizes;
+    vector<vector<long int>>      block_histograms;   // input of tree
+};
+
+struct sample {
+    double   seconds;
+    uint64_t cycles;
+};
+
+static uint64_t read_cycles() {
+#ifdef BENCH_HAS_TSC
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+// Same distributions as data_generator.cpp, with a fixed seed so runs can be compared
+void generate(int type, vector<unsigned char>& data) {
+    mt19937 gen(12345);
+    if (type == 0) {
+        uniform_int_distribution<> dis(0, 255);
+        for (unsigned char& c : data) c = dis(gen);
+    } else if (type == 1) {
+        const string pattern = "HelloWorldThisIsARepeatingPattern";
+        for (size_t i = 0; i < data.size(); i++) data[i] = pattern[i % pattern.length()];
+    } else {
+        exponential_distribution<> dis(0.1);
+        for (unsigned char& c : data) c = static_cast<int>(dis(gen)) % 256;
+    }
+}
+
+void prepare(corpus& c, int threads) {
+    size_t slice = (c.data.size() + threads - 1) / threads;
+    for (int t = 0; t < threads; t++) {
+        size_t offset = min(c.data.size(), t * slice);
+        c.slices.push_back(make_pair(offset, min(slice, c.data.size() - offset)));
+    }
+
+    long int      number[256] = {0};
+    unsigned char lengths[256];
+    count_bytes(c.data.data(), c.data.size(), number);
+    huffman_code_lengths(number, lengths);
+    limit_code_lengths(lengths, number, MAX_CODE_LENGTH);
+    c.codes.assign_canonical(lengths);
+
+    vector<decode_table::code> table_codes;
+    for (int ch = 0; ch < 256; ch++) {
+        if (number[ch]) table_codes.push_back(decode_table::code{c.codes.code[ch], c.codes.length[ch], (unsigned char)ch});
+    }
+    c.table.build(table_codes);
+
+    c.encoded.resize(threads);
+    for (int t = 0; t < threads; t++) {
+        unsigned char           last_byte;
+        int                     last_count;
+        bit_writer<vector_sink> writer(vector_sink{c.encoded[t]}, 0, 0);
+        writer.encode(c.data.data() + c.slices[t].first, c.slices[t].second, c.codes);
+        writer.finish(last_byte, last_count);
+        if (last_count) c.encoded[t].push_back(last_byte << (8 - last_count));
+    }
+
+    c.interleaved.resize(threads);
+    c.stream_sizes.resize(threads);
+    for (int t = 0; t < threads; t++) {
+        for (int k = 0; k < 4; k++) {
+            vector<unsigned char> lane;
+            for (size_t i = k; i < c.slices[t].second; i += 4) lane.push_back(c.data[c.slices[t].first + i]);
+            size_t                  before = c.interleaved[t].size();
+            unsigned char           last_byte;
+            int                     last_count;
+            bit_writer<vector_sink> writer(vector_sink{c.interleaved[t]}, 0, 0);
+            writer.encode(lane.data(), lane.size(), c.codes);
+            writer.finish(last_byte, last_count);
+            if (last_count) c.interleaved[t].push_back(last_byte << (8 - last_count));
+            c.stream_sizes[t].push_back(c.interleaved[t].size() - before);
+        }
+    }
+
+    for (size_t offset = 0; offset < c.data.size(); offset += STREAM_BLOCK_SIZE) {
+        vector<long int> histogram(256, 0);
+        count_bytes(c.data.data() + offset, min(STREAM_BLOCK_SIZE, c.data.size() - offset), histogram.data());
+        c.block_histograms.push_back(histogram);
+    }
+}
+
+// Runs the kernel once on every thread, returns a checksum so the work cannot be optimized away
+long int run_kernel(const string& kernel, corpus& c) {
+    long int checksum = 0;
+#pragma omp parallel reduction(+ : checksum)
+    {
+        const int            t      = omp_get_thread_num();
+        const int            n      = omp_get_num_threads();
+        const unsigned char* data   = c.data.data() + c.slices[t].first;
+        const size_t         length = c.slices[t].second;
+        if (kernel == "histogram") {
+            long int number[256] = {0};
+            count_bytes(data, length, number);
+            checksum += length ? number[data[0]] : 0;   // the last slices are empty when there are more threads than bytes
+        } else if (kernel == "tree") {
+            for (size_t b = t; b < c.block_histograms.size(); b += n) {
+                unsigned char lengths[256];
+                code_table    codes;
+                huffman_code_lengths(c.block_histograms[b].data(), lengths);
+                limit_code_lengths(lengths, c.block_histograms[b].data(), MAX_CODE_LENGTH);
+                codes.assign_canonical(lengths);
+                checksum += codes.code[b & 255];
+            }
+        } else if (kernel == "encode") {
+            vector<unsigned char> output;
+            output.reserve(c.encoded[t].size() + 64);
+            unsigned char           last_byte;
+            int                     last_count;
+            bit_writer<vector_sink> writer(vector_sink{output}, 0, 0);
+            writer.encode(data, length, c.codes);
+            writer.finish(last_byte, last_count);
+            checksum += output.size();
+        } else if (kernel == "crc32c") {
+            checksum += crc32c(data, length);
+        } else if (kernel == "decode4") {
+            vector<unsigned char> output(length);
+            vector<bit_reader>    readers;
+            const unsigned char*  stream = c.interleaved[t].data();
+            for (int k = 0; k < 4; k++) {
+                readers.push_back(bit_reader(stream, c.stream_sizes[t][k]));
+                stream += c.stream_sizes[t][k];
+            }
+            c.table.decode_interleaved<4>(readers.data(), output.data(), length);
+            checksum += output[length / 2];
+        } else {
+            vector<unsigned char> output(length);
+            bit_reader            reader(c.encoded[t].data(), c.encoded[t].size());
+            c.table.decode(reader, output.data(), length);
+            checksum += output[length / 2];
+        }
+    }
+    return checksum;
+}
+
+// Pins every OpenMP thread to one of the CPUs the process may use, the threads stay alive between regions
+void pin_threads(int threads) {
+    omp_set_dynamic(0);
+    omp_set_num_threads(threads);
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed)) return;
+    vector<int> cpus;
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, &allowed)) cpus.push_back(cpu);
+    }
+#pragma omp parallel
+    {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpus[omp_get_thread_num() % cpus.size()], &set);
+        sched_setaffinity(0, sizeof(set), &set);
+    }
+    if ((int)cpus.size() < threads) {
+        cerr << "Warning: " << threads << " threads share " << cpus.size() << " CPUs" << endl;
+    }
+}
+
+double percentile(const vector<double>& sorted, double p) {
+    size_t rank = (size_t)(p * (sorted.size() - 1) + 0.5);
+    return sorted[rank];
+}
+
+void report(const string& kernel, const corpus& c, vector<sample>& samples) {
+    sort(samples.begin(), samples.end(), [](const sample& a, const sample& b) { return a.seconds < b.seconds; });
+    vector<double> seconds;
+    for (const sample& s : samples) seconds.push_back(s.seconds);
+    const sample& median = samples[samples.size() / 2];
+    const double  bytes  = c.data.size();
+
+    printf("%-10s %-10s %9.3f %9.3f %9.3f %9.3f %9.3f %10.1f ", kernel.c_str(), c.name.c_str(), seconds.front() * 1e3,
+           percentile(seconds, 0.1) * 1e3, median.seconds * 1e3, percentile(seconds, 0.9) * 1e3, percentile(seconds, 0.99) * 1e3,
+           bytes / median.seconds / (1024 * 1024));
+    if (median.cycles) {
+        printf("%11.3f\n", bytes / median.cycles);
+    } else {
+        printf("%11s\n", "-");
+    }
+}
+
+bool parse(int argc, char* argv[], bench_options& options) {
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (i + 1 == argc) return false;
+        if (arg == "-s") {
+            options.size = (size_t)(atof(argv[++i]) * 1024 * 1024);
+        } else if (arg == "-r") {
+            options.repeats = atoi(argv[++i]);
+        } else if (arg == "-t") {
+            options.threads = atoi(argv[++i]);
+        } else if (arg == "-k") {
+            options.kernel = argv[++i];
+        } else if (arg == "-c") {
+            options.corpus = argv[++i];
+        } else {
+            return false;
+        }
+    }
+    return options.size >= 1024 && options.repeats > 0 && options.threads > 0;
+}
+
+int main(int argc, char* argv[]) {
+    bench_options options;
+    if (!parse(argc, argv, options)) {
+        cerr << "Usage: " << argv[0] << " [-s size_in_MB] [-r repeats] [-t threads] [-k kernel] [-c corpus]" << endl
+             << "kernels: histogram, tree, encode, decode, decode4, crc32c (default: all)" << endl
+             << "corpora: random, repeating, skewed (default: all)" << endl;
+        return 1;
+    }
+    pin_threads(options.threads);
+
+    const char* const kernels[] = {"histogram", "tree", "encode", "decode", "decode4", "crc32c"};
+    const char* const corpora[] = {"random", "repeating", "skewed"};
+
+    printf("size %.1f MB, %d runs, %d thread(s), times in ms\n", options.size / (1024.0 * 1024), options.repeats, options.threads);
+    printf("%-10s %-10s %9s %9s %9s %9s %9s %10s %11s\n", "kernel", "corpus", "min", "p10", "median", "p90", "p99", "MB/s", "bytes/cycle");
+    for (int type = 0; type < 3; type++) {
+        if (options.corpus != "all" && options.corpus != corpora[type]) continue;
+        corpus c;
+        c.name = corpora[type];
+        c.data.resize(options.size);
+        generate(type, c.data);
+        prepare(c, options.threads);
+
+        for (const char* kernel : kernels) {
+            if (options.kernel != "all" && options.kernel != kernel) continue;
+            vector<sample> samples;
+            long int       checksum = run_kernel(kernel, c);   // warm up
+            for (int r = 0; r < options.repeats; r++) {
+                auto     start        = chrono::steady_clock::now();
+                uint64_t start_cycles = read_cycles();
+                checksum += run_kernel(kernel, c);
+                uint64_t cycles = read_cycles() - start_cycles;
+                samples.push_back(sample{chrono::duration<double>(chrono::steady_clock::now() - start).count(), cycles});
+            }
+            if (checksum == 42) printf(" ");   // keeps the result alive
+            report(kernel, c, samples);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,288 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+// Loads 8 bytes as a 64-bit word with the first byte on the most significant side
+inline uint64_t load_be64(const unsigned char* p) {
+    uint64_t v;
+    memcpy(&v, p, 8);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    v = __builtin_bswap64(v);
+#endif
+    return v;
+}
+
+// Reads the compressed file as a stream of bits (most significant bit of every byte first).
+// Bits are kept left aligned in a 64-bit window that is refilled whole bytes at a time,
+// reading past the end of the input gives zero bits.
+// The input is either a FILE* read in blocks, or a buffer that is already in memory.
+struct bit_reader {
+    FILE*                      fp = NULL;
+    std::vector<unsigned char> input;
+    const unsigned char*       data = NULL;   // bytes that are not read yet are data[pos..end)
+    size_t                     pos = 0, end = 0;
+    uint64_t                   window = 0;   // next bits of the stream, left aligned
+    int                        avail  = 0;   // number of valid bits in window
+
+    bit_reader(FILE* f, size_t input_size = 64 * 1024) : fp(f), input(input_size), data(input.data()) {}
+    bit_reader(const unsigned char* buffer, size_t size) : data(buffer), end(size) {}
+
+    // after refill there are at least 56 bits in the window (the byte loop below stops at 57 or more)
+    inline void refill() {
+        if (end - pos >= 8) {
+            window |= load_be64(data + pos) >> avail;
+            int bytes = (63 - avail) >> 3;
+            pos += bytes;
+            avail += bytes * 8;
+            return;
+        }
+        while (avail <= 56) {
+            if (pos == end) {
+                end = fp ? fread(input.data(), 1, input.size(), fp) : 0;
+                pos = 0;
+                if (!end) {   // end of input, pretend the stream continues with zeros
+                    avail = 64;
+                    return;
+                }
+                if (end >= 8) {
+                    refill();
+                    return;
+                }
+            }
+            window |= (uint64_t)data[pos++] << (56 - avail);
+            avail += 8;
+        }
+    }
+
+    // n must be between 1 and 32, refill() has to be called before
+    inline uint32_t peek(int n) const { return window >> (64 - n); }
+    inline void     skip(int n) {
+        window <<= n;
+        avail -= n;
+    }
+
+    uint32_t read(int n) {
+        if (avail < n) refill();
+        uint32_t v = peek(n);
+        skip(n);
+        return v;
+    }
+
+    // drops the partial byte so that the next read starts at a byte boundary of the file
+    void align() { skip(avail % 8); }
+
+    // copies the next n bytes of the file to out, the stream has to be at a byte boundary (align()).
+    // Bytes already in the window and in the input buffer come first, the rest is read straight from the file
+    void read_bytes(unsigned char* out, size_t n) {
+        for (; n && avail >= 8; n--) {
+            *out++ = window >> 56;
+            skip(8);
+        }
+        if (!n) return;
+        window = 0;   // refill() may have loaded bits past avail, they belong to the bytes copied below
+        size_t buffered = end - pos < n ? end - pos : n;
+        memcpy(out, data + pos, buffered);
+        pos += buffered;
+        out += buffered;
+        n -= buffered;
+        size_t got = n && fp ? fread(out, 1, n, fp) : 0;
+        memset(out + got, 0, n - got);   // past the end of the input, like refill()
+    }
+};
+
+// Multi level lookup table that replaces the bit by bit walk on the Huffman tree.
+// The root table is indexed by the next ROOT_BITS bits of the stream. An entry either holds the byte
+// and the length of its code, or links to a sub table that is indexed by the bits after the prefix.
+// When two short codes fit in ROOT_BITS together, the root entry holds both bytes so one lookup decodes two.
+struct decode_table {
+    static const int ROOT_BITS = 11;
+    static const int SUB_BITS  = 8;
+
+    struct entry {
+        uint32_t      value;          // byte (second byte in bits 8-15 for pairs) or the offset of the sub table
+        unsigned char length;         // bits to consume for every byte in the entry
+        unsigned char link;           // bits used to index the sub table, 0 for bytes
+        unsigned char count;          // number of bytes in the entry
+        unsigned char first_length;   // bits to consume for the first byte only
+    };
+
+    struct code {
+        uint64_t      word;
+        int           length;
+        unsigned char character;
+    };
+
+    std::vector<entry> entries;
+
+    // builds the tables from the code words of every unique byte (codes must be prefix free)
+    void build(const std::vector<code>& codes) {
+        entries.clear();
+        build_level(codes, 0, ROOT_BITS);
+        pair_root();
+    }
+
+    // decodes one byte, the reader has to be refilled before
+    inline unsigned char decode(bit_reader& in) const {
+        const entry* e = &entries[in.peek(ROOT_BITS)];
+        while (e->link) {
+            in.skip(e->length);
+            if (in.avail < 32) in.refill();
+            e = &entries[e->value + in.peek(e->link)];
+        }
+        in.skip(e->first_length);
+        return e->value;
+    }
+
+    // fills out[0..n), codes that fit in the root table are handled inline.
+    // The window is kept in locals since out may alias the reader and would force a reload after every store
+    void decode(bit_reader& in, unsigned char* out, size_t n) const {
+        const entry* root   = entries.data();
+        uint64_t     window = in.window;
+        int          avail  = in.avail;
+        for (size_t i = 0; i < n; i++) {
+            if (avail < 32) {
+                in.window = window;
+                in.avail  = avail;
+                in.refill();
+                window = in.window;
+                avail  = in.avail;
+            }
+            const entry& e = root[window >> (64 - ROOT_BITS)];
+            if (__builtin_expect(!e.link, 1)) {
+                if (e.count == 2 && i + 1 < n) {
+                    out[i++] = e.value;
+                    out[i]   = e.value >> 8;
+                    window <<= e.length;
+                    avail -= e.length;
+                } else {
+                    out[i] = e.value;
+                    window <<= e.first_length;
+                    avail -= e.first_length;
+                }
+            } else {
+                in.window = window;
+                in.avail  = avail;
+                out[i]    = decode(in);
+                window    = in.window;
+                avail     = in.avail;
+            }
+        }
+        in.window = window;
+        in.avail  = avail;
+    }
+
+    // Fills out[0..n) from N streams that hold the bytes round robin (byte i is in stream i % N).
+    // The streams do not depend on each other, so the N lookups of a round can be in flight at the same time
+    // instead of every lookup waiting for the length of the code before it. Readers must read from memory.
+    template <int N> void decode_interleaved(bit_reader* in, unsigned char* out, size_t n) const {
+        const entry*         root = entries.data();
+        uint64_t             window[N];
+        int                  avail[N];
+        const unsigned char* p[N];
+        const unsigned char* fast_end[N];   // a whole 64-bit load fits before this point
+        for (int k = 0; k < N; k++) {
+            window[k]   = in[k].window;
+            avail[k]    = in[k].avail;
+            p[k]        = in[k].data + in[k].pos;
+            fast_end[k] = in[k].data + (in[k].end >= 8 ? in[k].end - 8 : 0);
+        }
+
+        const size_t rounds = n / N;
+        for (size_t r = 0; r < rounds; r++) {
+            for (int k = 0; k < N; k++) {
+                if (avail[k] < ROOT_BITS) {   // longer codes refill in decode()
+                    if (p[k] <= fast_end[k] && in[k].end >= 8) {
+                        window[k] |= load_be64(p[k]) >> avail[k];
+                        int bytes = (63 - avail[k]) >> 3;
+                        p[k] += bytes;
+                        avail[k] += bytes * 8;
+                    } else {
+                        sync(in[k], window[k], avail[k], p[k]);
+                        in[k].refill();
+                        load(in[k], window[k], avail[k], p[k]);
+                    }
+                }
+                const entry& e = root[window[k] >> (64 - ROOT_BITS)];
+                if (__builtin_expect(!e.link, 1)) {
+                    out[r * N + k] = e.value;   // first byte of pair entries is in the low bits
+                    window[k] <<= e.first_length;
+                    avail[k] -= e.first_length;
+                } else {
+                    sync(in[k], window[k], avail[k], p[k]);
+                    if (in[k].avail < 32) in[k].refill();
+                    out[r * N + k] = decode(in[k]);
+                    load(in[k], window[k], avail[k], p[k]);
+                }
+            }
+        }
+        for (int k = 0; k < N; k++) {
+            sync(in[k], window[k], avail[k], p[k]);
+        }
+        for (size_t i = rounds * N; i < n; i++) {
+            bit_reader& lane = in[i % N];
+            if (lane.avail < 32) lane.refill();
+            out[i] = decode(lane);
+        }
+    }
+
+  private:
+    static void sync(bit_reader& in, uint64_t window, int avail, const unsigned char* p) {
+        in.window = window;
+        in.avail  = avail;
+        in.pos    = p - in.data;
+    }
+    static void load(const bit_reader& in, uint64_t& window, int& avail, const unsigned char*& p) {
+        window = in.window;
+        avail  = in.avail;
+        p      = in.data + in.pos;
+    }
+
+    // creates the table for codes that share their first 'consumed' bits and returns its offset
+    size_t build_level(const std::vector<code>& codes, int consumed, int bits) {
+        size_t offset = entries.size();
+        entries.resize(offset + ((size_t)1 << bits), entry{0, 0, 0, 0, 0});
+
+        std::vector<std::vector<code>> longer(1 << bits);
+        for (const code& c : codes) {
+            int rest = c.length - consumed;
+            if (rest <= bits) {
+                uint32_t first = rest ? (uint32_t)(c.word & ((1ULL << rest) - 1)) << (bits - rest) : 0;
+                for (uint32_t i = 0; i < (1u << (bits - rest)); i++) {
+                    entries[offset + first + i] = entry{c.character, (unsigned char)rest, 0, 1, (unsigned char)rest};
+                }
+            } else {
+                longer[(c.word >> (rest - bits)) & ((1u << bits) - 1)].push_back(c);
+            }
+        }
+
+        for (uint32_t i = 0; i < longer.size(); i++) {
+            if (longer[i].empty()) continue;
+            int deepest = 0;
+            for (const code& c : longer[i]) deepest = c.length > deepest ? c.length : deepest;
+            int    sub_bits = deepest - consumed - bits < SUB_BITS ? deepest - consumed - bits : SUB_BITS;
+            size_t sub      = build_level(longer[i], consumed + bits, sub_bits);
+            entries[offset + i] = entry{(uint32_t)sub, (unsigned char)bits, (unsigned char)sub_bits, 0, (unsigned char)bits};
+        }
+        return offset;
+    }
+
+    // Looks at the bits left after the first code of every root entry. If they already hold a whole code,
+    // the entry gets that byte too. Only the first length bits of an entry matter, so the unknown bits
+    // after the index are never used.
+    void pair_root() {
+        const uint32_t     mask = (1u << ROOT_BITS) - 1;
+        std::vector<entry> single(entries.begin(), entries.begin() + (1 << ROOT_BITS));
+        for (uint32_t i = 0; i <= mask; i++) {
+            const entry& first = single[i];
+            if (first.link || first.length == 0) continue;
+            const entry& second = single[(i << first.length) & mask];
+            if (second.link || second.length == 0 || first.length + second.length > ROOT_BITS) continue;
+            entries[i].value |= second.value << 8;
+            entries[i].length = first.length + second.length;
+            entries[i].count  = 2;
+        }
+    }
+};
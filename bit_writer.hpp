@@ -0,0 +1,102 @@
+#pragma once
+
+#include "code_table.hpp"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+// Stores a 64-bit word with its most significant byte first, which is the bit order of the compressed file
+inline void store_be64(unsigned char* p, uint64_t v) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    v = __builtin_bswap64(v);
+#endif
+    memcpy(p, &v, 8);
+}
+
+// Output targets of the bit writer
+struct file_sink {
+    FILE* fp;
+    void  write(const unsigned char* p, size_t n) { fwrite(p, 1, n, fp); }
+};
+
+struct vector_sink {
+    std::vector<unsigned char>& buffer;
+    void                        write(const unsigned char* p, size_t n) { buffer.insert(buffer.end(), p, p + n); }
+};
+
+// Bit packer used for the eighth part of the compressed file.
+// Code words are collected in a 64-bit accumulator and only whole words are flushed to the staging buffer,
+// which is handed to the sink once it is full.
+// It takes over the (current_byte, current_bit_count) pair of the caller and gives the leftover bits back in finish(),
+// so the rest of the bit-by-bit writers keep working on the same stream.
+template <class Sink> struct bit_writer {
+    Sink                       sink;
+    uint64_t                   acc   = 0;   // pending bits, right aligned
+    int                        count = 0;   // number of pending bits in acc (always less than 64)
+    std::vector<unsigned char> staging;     // whole words waiting for the sink, size is a multiple of 8
+    size_t                     used    = 0;
+    uint64_t                   flushed = 0;   // bytes handed to the sink
+
+    bit_writer(Sink s, unsigned char current_byte, int current_bit_count, size_t staging_size = 64 * 1024)
+        : sink(s), staging(staging_size) {
+        count = current_bit_count;
+        acc   = count ? current_byte & (0xFF >> (8 - count)) : 0;
+    }
+
+    // appends len (at most 32) bits of code
+    inline void put32(uint64_t code, int len) {
+        if (count + len < 64) {
+            acc = (acc << len) | code;
+            count += len;
+            return;
+        }
+        int room = 64 - count;   // count >= 32 here, so room and len-room are valid shift amounts
+        count    = len - room;
+        if (used + 8 > staging.size()) {
+            flushed += used;
+            sink.write(staging.data(), used);
+            used = 0;
+        }
+        store_be64(&staging[used], (acc << room) | (code >> count));
+        used += 8;
+        acc = code & ((1ULL << count) - 1);
+    }
+
+    inline void put(uint64_t code, int len) {
+        if (len > 32) {
+            put32(code >> 32, len - 32);
+            put32(code & 0xFFFFFFFFULL, 32);
+        } else {
+            put32(code, len);
+        }
+    }
+
+    // bits written so far, counted from the first bit of the byte the writer started in
+    uint64_t bits() const { return 8 * (flushed + used) + count; }
+
+    void encode(const unsigned char* data, size_t n, const code_table& codes) {
+        for (size_t i = 0; i < n; i++) {
+            put(codes.code[data[i]], codes.length[data[i]]);
+        }
+    }
+
+    // writes every complete byte and returns the remaining (less than 8) bits to the caller
+    void finish(unsigned char& current_byte, int& current_bit_count) {
+        while (count >= 8) {
+            if (used == staging.size()) {
+                flushed += used;
+                sink.write(staging.data(), used);
+                used = 0;
+            }
+            count -= 8;
+            staging[used++] = acc >> count;
+        }
+        flushed += used;
+        sink.write(staging.data(), used);
+        used              = 0;
+        current_byte      = count ? acc & (0xFF >> (8 - count)) : 0;
+        current_bit_count = count;
+    }
+};
@@ -0,0 +1,165 @@
+#pragma once
+
+#include <cctype>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+#include "stream_format.hpp"
+
+// Command line options shared by archive, modified_archive and extract.
+// Every question the programs would ask on standard input can be answered here instead, so batch jobs
+// run without prompts. Options come before the file names:
+//
+//   -p, --password <password>   protect the archive with (or, for extract, open it with) this password
+//   -n, --no-password           no password, do not ask for one
+//   -y, --yes                   write the compressed file without asking for confirmation
+//   -q, --quiet                 do not draw the progress bar
+//   -b, --batch                 same as --no-password --yes --quiet
+//       --stream                stream mode (see stream_format.hpp)
+//       --interleave[=<N>]      with --stream, split every block into N interleaved streams (default 4) that
+//                               decode faster, archive only
+//       --train=<file>          build a translation table from the input files and save it instead of compressing
+//       --table=<id>            compress with a trained table (a preset name or a --train file) and skip the
+//                               counting pass (compressors only, see trained_table.hpp)
+//       --seek[=<KB>]           seek point in the index every KB of input of every file, so parts of a file can be
+//                               read and verified without decoding it from the start. Without the option (and
+//                               without KB) there is one every 1024 KB, the checksum block of the index, so
+//                               --verify spreads every block over the cores (compressors only)
+//       --memory=<MB>           encoded output modified_archive keeps in memory before it is written (default 256)
+//       --pwrite                modified_archive computes the place of every chunk from the counts of the first pass
+//                               and every thread writes its chunks there itself (not with --table)
+//       --io-uring              stat, open and read the small files of folders in batches with io_uring, POSIX calls
+//                               are used where io_uring is not available (archive only, see io_uring_batch.hpp)
+//       --pipeline              read ahead and write behind on their own threads while files larger than 1MB are
+//                               encoded, for cold caches and slow disks (archive only, see pipeline.hpp)
+//       --list                  print the files and folders of an archive from its index, extract only
+//       --verify                check the checksums of every block of an archive on all cores without writing
+//                               anything, extract only
+//       --range=<offset>:<length>
+//                               write bytes [offset, offset + length) of the one file given after the archive to
+//                               standard output, extract only (see archive_reader.hpp)
+//       --timing[=<file>]       JSON report of the time spent in every phase, on standard error or in <file>
+//                               (compressors only, see phase_timer.hpp)
+//       --                      end of the options, the next argument is a file name even if it starts with '-'
+struct cli_options {
+    bool        ask_password     = true;    // prompt for the password on standard input
+    bool        has_password     = false;   // password was given with --password
+    std::string password;
+    bool        ask_confirmation = true;    // "write 0 to abort" prompt of the compressors
+    bool        show_progress    = true;
+    bool        stream           = false;
+    long int    seek_interval    = 1024 * 1024;   // --seek, in bytes
+    long int    memory           = 256L * 1024 * 1024;   // --memory, in bytes
+    bool        pwrite           = false;
+    bool        io_uring         = false;
+    bool        pipeline         = false;
+    bool        list             = false;
+    bool        verify           = false;
+    bool        range            = false;
+    uint64_t    range_offset     = 0;
+    uint64_t    range_length     = 0;
+    int         streams          = 1;   // --interleave
+    std::string train;                  // --train: table file to write
+    std::string table;                  // --table: preset or table file to use
+    bool        timing           = false;
+    std::string timing_file;   // empty: standard error
+};
+
+// Reads the options at the start of argv and removes them, so argv[1..argc) are the file names again.
+// Prints the reason and returns false for an unknown option or a missing password
+inline bool parse_options(int& argc, char**& argv, cli_options& options) {
+    int i = 1;
+    for (; i < argc && argv[i][0] == '-'; i++) {
+        const char* arg = argv[i];
+        if (!strcmp(arg, "--")) {
+            i++;
+            break;
+        } else if (!strcmp(arg, "-p") || !strcmp(arg, "--password")) {
+            if (i + 1 == argc) {
+                std::cout << arg << " needs a password" << std::endl;
+                return false;
+            }
+            options.password     = argv[++i];
+            options.has_password = true;
+            options.ask_password = false;
+        } else if (!strncmp(arg, "--password=", 11)) {
+            options.password     = arg + 11;
+            options.has_password = true;
+            options.ask_password = false;
+        } else if (!strcmp(arg, "-n") || !strcmp(arg, "--no-password")) {
+            options.ask_password = false;
+        } else if (!strcmp(arg, "-y") || !strcmp(arg, "--yes")) {
+            options.ask_confirmation = false;
+        } else if (!strcmp(arg, "-q") || !strcmp(arg, "--quiet")) {
+            options.show_progress = false;
+        } else if (!strcmp(arg, "-b") || !strcmp(arg, "--batch")) {
+            options.ask_password     = false;
+            options.ask_confirmation = false;
+            options.show_progress    = false;
+        } else if (!strcmp(arg, "--timing")) {
+            options.timing = true;
+        } else if (!strncmp(arg, "--timing=", 9)) {
+            options.timing      = true;
+            options.timing_file = arg + 9;
+        } else if (!strncmp(arg, "--train=", 8) && arg[8]) {
+            options.train = arg + 8;
+        } else if (!strncmp(arg, "--table=", 8) && arg[8]) {
+            options.table = arg + 8;
+        } else if (!strcmp(arg, "--seek")) {
+            options.seek_interval = 1024 * 1024;
+        } else if (!strncmp(arg, "--seek=", 7)) {
+            options.seek_interval = atol(arg + 7) * 1024;
+            if (options.seek_interval <= 0) {
+                std::cout << arg << ": the interval must be at least 1 KB" << std::endl;
+                return false;
+            }
+        } else if (!strncmp(arg, "--memory=", 9)) {
+            options.memory = atol(arg + 9) * 1024 * 1024;
+            if (options.memory <= 0) {
+                std::cout << arg << ": the limit must be at least 1 MB" << std::endl;
+                return false;
+            }
+        } else if (!strcmp(arg, "--pwrite")) {
+            options.pwrite = true;
+        } else if (!strcmp(arg, "--io-uring")) {
+            options.io_uring = true;
+        } else if (!strcmp(arg, "--pipeline")) {
+            options.pipeline = true;
+        } else if (!strcmp(arg, "--list")) {
+            options.list = true;
+        } else if (!strcmp(arg, "--verify")) {
+            options.verify = true;
+        } else if (!strncmp(arg, "--range=", 8)) {
+            char* end;
+            options.range        = true;
+            options.range_offset = strtoull(arg + 8, &end, 10);
+            bool valid           = isdigit((unsigned char)arg[8]) && *end == ':' && isdigit((unsigned char)end[1]);
+            if (valid) options.range_length = strtoull(end + 1, &end, 10);
+            if (!valid || *end) {
+                std::cout << arg << ": use --range=<offset>:<length>" << std::endl;
+                return false;
+            }
+        } else if (!strcmp(arg, "--stream")) {
+            options.stream = true;
+        } else if (!strcmp(arg, "--interleave")) {
+            options.streams = 4;
+        } else if (!strncmp(arg, "--interleave=", 13)) {
+            options.streams = atoi(arg + 13);
+            if (options.streams < 1 || options.streams > MAX_STREAMS) {
+                std::cout << arg << ": the number of streams must be between 1 and " << MAX_STREAMS << std::endl;
+                return false;
+            }
+        } else {
+            std::cout << "Unknown option " << arg << std::endl;
+            return false;
+        }
+    }
+    // keep the program name in argv[0]
+    argv[i - 1] = argv[0];
+    argv += i - 1;
+    argc -= i - 1;
+    return true;
+}
@@ -0,0 +1,137 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// Longest transformation a byte may get. Codes are limited so the encoder and decoder tables stay small.
+// With 11 bits or less every code fits in the root table of decode_table and is decoded with a single lookup,
+// 12 keeps the loss on very skewed inputs well below 1% and only the rarest bytes need a second lookup.
+// Any value from 8 (enough room for 256 unique bytes) to 15 can be chosen with -DHUFFMAN_MAX_CODE_LENGTH=...
+#ifndef HUFFMAN_MAX_CODE_LENGTH
+#define HUFFMAN_MAX_CODE_LENGTH 12
+#endif
+const int MAX_CODE_LENGTH       = HUFFMAN_MAX_CODE_LENGTH;
+const int MAX_CODE_LENGTH_LIMIT = 15;   // the longest length an archive may contain
+static_assert(MAX_CODE_LENGTH >= 8 && MAX_CODE_LENGTH <= MAX_CODE_LENGTH_LIMIT, "HUFFMAN_MAX_CODE_LENGTH must be between 8 and 15");
+
+// Integer version of the translation table.
+// Every unique byte gets its transformation as a right aligned code word plus its length in bits.
+// Code words are canonical: they follow from the lengths alone, so the compressed file only stores the lengths.
+struct code_table {
+    uint64_t      code[256];
+    unsigned char length[256];
+
+    code_table() {
+        memset(code, 0, sizeof(code));
+        memset(length, 0, sizeof(length));
+    }
+
+    // Bytes sorted by (length, byte) get consecutive code words, a longer code continues from the
+    // next free code word of the shorter ones shifted left. lengths[c] == 0 means c is not used
+    // (or it is the only unique byte, which needs no bits at all).
+    void assign_canonical(const unsigned char* lengths) {
+        int      count[MAX_CODE_LENGTH_LIMIT + 1] = {0};
+        uint64_t next[MAX_CODE_LENGTH_LIMIT + 1]  = {0};
+        for (int c = 0; c < 256; c++) {
+            count[lengths[c]]++;
+        }
+        count[0]      = 0;
+        uint64_t word = 0;
+        for (int l = 1; l <= MAX_CODE_LENGTH_LIMIT; l++) {
+            word    = (word + count[l - 1]) << 1;
+            next[l] = word;
+        }
+        for (int c = 0; c < 256; c++) {
+            length[c] = lengths[c];
+            code[c]   = lengths[c] ? next[lengths[c]]++ : 0;
+        }
+    }
+};
+
+// Makes sure no length is longer than max_length. lengths[] holds the depth of every byte in the Huffman tree
+// (0 for unused bytes) and is left untouched when it already fits. Otherwise the long codes are cut to
+// max_length and the Kraft sum is repaired by moving codes one level down, then the lengths are given back
+// to the bytes in order of frequency so the most used bytes keep the shortest codes.
+inline void limit_code_lengths(unsigned char* lengths, const long int* number, int max_length) {
+    int longest = 0;
+    for (int c = 0; c < 256; c++) {
+        longest = std::max<int>(longest, lengths[c]);
+    }
+    if (longest <= max_length) return;
+
+    int count[256] = {0};   // number of codes of every length
+    for (int c = 0; c < 256; c++) {
+        if (lengths[c]) count[std::min<int>(lengths[c], max_length)]++;
+    }
+
+    // every step takes one code away from the last level and splits a shorter code into two,
+    // which lowers the Kraft sum (in units of 2^-max_length) by exactly one
+    uint32_t total = 0;
+    for (int l = 1; l <= max_length; l++) {
+        total += (uint32_t)count[l] << (max_length - l);
+    }
+    while (total > (1u << max_length)) {
+        count[max_length]--;
+        for (int l = max_length - 1; l > 0; l--) {
+            if (count[l]) {
+                count[l]--;
+                count[l + 1] += 2;
+                break;
+            }
+        }
+        total--;
+    }
+
+    std::vector<int> used;
+    for (int c = 0; c < 256; c++) {
+        if (lengths[c]) used.push_back(c);
+    }
+    std::stable_sort(used.begin(), used.end(), [number](int a, int b) { return number[a] > number[b]; });
+    size_t next = 0;
+    for (int l = 1; l <= max_length; l++) {
+        for (int i = 0; i < count[l]; i++) {
+            lengths[used[next++]] = l;
+        }
+    }
+}
+
+// Finds the Huffman code length of every byte from its frequency (0 for unused bytes and for a single unique byte).
+// Same two queue construction as the translation tree in Compressor.cpp: leaves sorted by frequency are merged
+// with the nodes created before, which come out in increasing order of weight by themselves.
+inline void huffman_code_lengths(const long int* number, unsigned char* lengths) {
+    std::vector<int> leaves;
+    for (int c = 0; c < 256; c++) {
+        lengths[c] = 0;
+        if (number[c]) leaves.push_back(c);
+    }
+    std::stable_sort(leaves.begin(), leaves.end(), [number](int a, int b) { return number[a] < number[b]; });
+    const int n = leaves.size();
+    if (n < 2) return;
+
+    std::vector<long int> weight(2 * n - 1);
+    std::vector<int>      parent(2 * n - 1, 0), depth(2 * n - 1, 0);
+    for (int i = 0; i < n; i++) {
+        weight[i] = number[leaves[i]];
+    }
+    int leaf = 0, inner = n;   // next unused leaf and next unused merged node
+    for (int next = n; next < 2 * n - 1; next++) {
+        int pick[2];
+        for (int k = 0; k < 2; k++) {
+            if (leaf < n && (inner == next || weight[leaf] < weight[inner])) {
+                pick[k] = leaf++;
+            } else {
+                pick[k] = inner++;
+            }
+        }
+        weight[next]    = weight[pick[0]] + weight[pick[1]];
+        parent[pick[0]] = parent[pick[1]] = next;
+    }
+    for (int i = 2 * n - 3; i >= 0; i--) {
+        depth[i] = depth[parent[i]] + 1;
+    }
+    for (int i = 0; i < n; i++) {
+        lengths[leaves[i]] = depth[i];
+    }
+}
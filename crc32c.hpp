@@ -0,0 +1,88 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <nmmintrin.h>
+#define CRC32C_HAS_SSE42 1
+#endif
+
+// CRC32C (Castagnoli polynomial, the one of iSCSI and ext4) of the checksum blocks of the archive index
+// (see archive_format.hpp). SSE 4.2 has an instruction for it that takes 8 bytes at a time; other CPUs use
+// a slicing-by-8 table kernel, which looks up the 8 bytes of a word in 8 tables so the lookups do not wait on each other.
+
+const uint32_t CRC32C_POLYNOMIAL = 0x82F63B78;   // reflected
+
+typedef uint32_t (*crc32c_kernel)(uint32_t, const unsigned char*, size_t);
+
+struct crc32c_tables {
+    uint32_t table[8][256];
+    crc32c_tables() {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t crc = i;
+            for (int bit = 0; bit < 8; bit++) crc = crc & 1 ? (crc >> 1) ^ CRC32C_POLYNOMIAL : crc >> 1;
+            table[0][i] = crc;
+        }
+        for (uint32_t i = 0; i < 256; i++) {
+            for (int k = 1; k < 8; k++) table[k][i] = (table[k - 1][i] >> 8) ^ table[0][table[k - 1][i] & 0xFF];
+        }
+    }
+};
+
+// portable kernel, crc is the running value without the final inversion
+inline uint32_t crc32c_generic(uint32_t crc, const unsigned char* data, size_t n) {
+    static const crc32c_tables tables;
+    const uint32_t(*t)[256] = tables.table;
+    size_t i                = 0;
+    for (; i + 8 <= n; i += 8) {
+        uint32_t low, high;
+        memcpy(&low, data + i, 4);
+        memcpy(&high, data + i + 4, 4);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        low  = __builtin_bswap32(low);
+        high = __builtin_bswap32(high);
+#endif
+        low ^= crc;
+        crc = t[7][low & 0xFF] ^ t[6][(low >> 8) & 0xFF] ^ t[5][(low >> 16) & 0xFF] ^ t[4][low >> 24] ^ t[3][high & 0xFF] ^
+              t[2][(high >> 8) & 0xFF] ^ t[1][(high >> 16) & 0xFF] ^ t[0][high >> 24];
+    }
+    for (; i < n; i++) {
+        crc = (crc >> 8) ^ t[0][(crc ^ data[i]) & 0xFF];
+    }
+    return crc;
+}
+
+#ifdef CRC32C_HAS_SSE42
+__attribute__((target("sse4.2"))) inline uint32_t crc32c_sse42(uint32_t crc, const unsigned char* data, size_t n) {
+    size_t i = 0;
+#ifdef __x86_64__
+    uint64_t wide = crc;
+    for (; i + 8 <= n; i += 8) {
+        uint64_t word;
+        memcpy(&word, data + i, 8);
+        wide = _mm_crc32_u64(wide, word);
+    }
+    crc = wide;
+#endif
+    for (; i < n; i++) {
+        crc = _mm_crc32_u8(crc, data[i]);
+    }
+    return crc;
+}
+#endif
+
+// picks the kernel once, based on what the CPU running the program supports
+inline crc32c_kernel select_crc32c_kernel() {
+#ifdef CRC32C_HAS_SSE42
+    if (__builtin_cpu_supports("sse4.2")) return crc32c_sse42;
+#endif
+    return crc32c_generic;
+}
+
+// CRC32C of data[0..n), crc32c("123456789", 9) is 0xE3069283
+inline uint32_t crc32c(const unsigned char* data, size_t n) {
+    static const crc32c_kernel kernel = select_crc32c_kernel();
+    return ~kernel(0xFFFFFFFF, data, n);
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// Byte frequency counting kernel for the first pass.
+// A plain number[x]++ loop stalls whenever the same byte repeats, because every increment has to wait for
+// the store of the previous one. The kernel below spreads consecutive bytes over HISTOGRAM_TABLES interleaved
+// sub tables of 32-bit counters, which are added to the caller's long int counters after every flush block.
+// There is no SIMD kernel: AVX2 has no scatter or conflict detection, so a vector kernel ends up doing the same
+// scalar increments after its own loads and was slower than this one on every corpus of make bench.
+
+const int    HISTOGRAM_TABLES = 8;
+const size_t HISTOGRAM_FLUSH  = (size_t)1 << 30;   // bytes per flush block, no 32-bit counter can overflow
+
+// 8 bytes per load, byte k of the word goes to sub table k
+inline void count_bytes_tables(const unsigned char* data, size_t n, uint32_t (*tables)[256]) {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        uint64_t word;
+        memcpy(&word, data + i, 8);
+        tables[0][word & 0xFF]++;
+        tables[1][(word >> 8) & 0xFF]++;
+        tables[2][(word >> 16) & 0xFF]++;
+        tables[3][(word >> 24) & 0xFF]++;
+        tables[4][(word >> 32) & 0xFF]++;
+        tables[5][(word >> 40) & 0xFF]++;
+        tables[6][(word >> 48) & 0xFF]++;
+        tables[7][word >> 56]++;
+    }
+    for (; i < n; i++) {
+        tables[0][data[i]]++;
+    }
+}
+
+// adds the byte frequencies of data[0..n) to number[256]
+inline void count_bytes(const unsigned char* data, size_t n, long int* number) {
+    uint32_t tables[HISTOGRAM_TABLES][256];
+    while (n) {
+        size_t block = n < HISTOGRAM_FLUSH ? n : HISTOGRAM_FLUSH;
+        memset(tables, 0, sizeof(tables));
+        count_bytes_tables(data, block, tables);
+        for (int c = 0; c < 256; c++) {
+            uint64_t sum = 0;
+            for (int t = 0; t < HISTOGRAM_TABLES; t++) {
+                sum += tables[t][c];
+            }
+            number[c] += sum;
+        }
+        data += block;
+        n -= block;
+    }
+}
+
+// Files and stream blocks whose bytes carry at least this many bits of information per byte are stored as they are:
+// no Huffman code makes them noticeably smaller (random or already compressed data), so encoding only costs time
+const double STORED_ENTROPY = 7.9;
+
+// Shannon entropy of the counted bytes in bits per byte, the least any code built for these counts can average
+inline double bits_per_byte(const long int* number) {
+    double total = 0, sum = 0;
+    for (int c = 0; c < 256; c++) {
+        total += number[c];
+    }
+    if (total == 0) return 0;
+    for (int c = 0; c < 256; c++) {
+        if (number[c]) sum += number[c] * std::log2(number[c] / total);
+    }
+    return -sum / total;
+}
@@ -0,0 +1,44 @@
+#include "huffman.hpp"
+
+#include "stream_format.hpp"
+
+#include <algorithm>
+
+// Serial engine of the library, the parallel engine is in huffman_openmp.cpp
+
+namespace huffman {
+
+bool compress_parallel(const uint8_t*, size_t, output_sink&, int);
+bool decompress_parallel(const uint8_t*, size_t, output_sink&);
+
+bool compress(const uint8_t* data, size_t size, output_sink& out, engine e, int streams) {
+    if (streams < 1 || streams > MAX_STREAMS) return false;
+    if (e == engine::parallel) return compress_parallel(data, size, out, streams);
+
+    std::vector<uint8_t> block;
+    for (size_t done = 0; done < size; done += STREAM_BLOCK_SIZE) {
+        block.clear();
+        encode_block(data + done, std::min(STREAM_BLOCK_SIZE, size - done), block, streams);
+        if (!out.write(block.data(), block.size())) return false;
+    }
+    block.clear();
+    append_uint32(block, 0);
+    return out.write(block.data(), block.size());
+}
+
+bool decompress(const uint8_t* data, size_t size, output_sink& out, engine e) {
+    if (e == engine::parallel) return decompress_parallel(data, size, out);
+
+    std::vector<uint8_t> original(STREAM_BLOCK_SIZE);
+    block_info           block;
+    while (true) {
+        size_t used = parse_block(data, size, block);
+        if (!used) return false;
+        if (!block.size) return true;
+        if (!decode_block(block, original.data()) || !out.write(original.data(), block.size)) return false;
+        data += used;
+        size -= used;
+    }
+}
+
+}   // namespace huffman
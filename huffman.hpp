@@ -0,0 +1,87 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+#include "stream_format.hpp"
+
+// In-memory compression library (libhuffman.a).
+// compress() turns a buffer into the block layout of the streaming mode (see stream_format.hpp), so its output
+// can also be read by 'extract --stream' and the output of 'archive --stream' can be given to decompress().
+// Nothing is printed and nothing exits the process: errors are reported with the return value.
+//
+// The serial engine lives in huffman.cpp, the OpenMP engine in huffman_openmp.cpp and the block codec both of them
+// use in huffman_block.cpp. Programs that call compress() or decompress() have to be linked with -fopenmp,
+// the block functions alone (used by the streaming mode of archive and extract) do not need it.
+//
+//     std::vector<uint8_t> packed;
+//     huffman::vector_output_sink sink(packed);
+//     huffman::compress(data, size, sink, huffman::engine::parallel);
+
+namespace huffman {
+
+// Receives the output in order, a false return stops the operation
+struct output_sink {
+    virtual ~output_sink() {}
+    virtual bool write(const uint8_t* data, size_t size) = 0;
+};
+
+// appends the output to a vector
+struct vector_output_sink : output_sink {
+    std::vector<uint8_t>& buffer;
+    explicit vector_output_sink(std::vector<uint8_t>& b) : buffer(b) {}
+    bool write(const uint8_t* data, size_t size) override {
+        buffer.insert(buffer.end(), data, data + size);
+        return true;
+    }
+};
+
+// writes the output to an open FILE*
+struct file_output_sink : output_sink {
+    FILE* fp;
+    explicit file_output_sink(FILE* f) : fp(f) {}
+    bool write(const uint8_t* data, size_t size) override { return fwrite(data, 1, size, fp) == size; }
+};
+
+enum class engine {
+    serial,     // one block after the other on the calling thread
+    parallel,   // blocks are encoded (decoded) on all OpenMP threads and written in order
+};
+
+// Compresses data[0..size) and writes the result to out.
+// streams > 1 writes interleaved blocks (see stream_format.hpp), which decode faster on one core
+bool compress(const uint8_t* data, size_t size, output_sink& out, engine e = engine::serial, int streams = 1);
+
+// Reverse of compress(), writes the original bytes to out. Returns false for input that is not a complete stream
+bool decompress(const uint8_t* data, size_t size, output_sink& out, engine e = engine::serial);
+
+// One block of the stream, fields 1 to 5 of stream_format.hpp
+struct block_info {
+    uint32_t       size         = 0;   // bytes of the original block, 0 for the end of the stream
+    int            letter_count = 0;
+    uint8_t        letters[512];           // unique byte and the length of its transformation, letter_count pairs
+    bool           stored       = false;   // encoded holds the original bytes
+    int            streams      = 1;       // number of interleaved streams, 1 for a plain block
+    uint32_t       stream_size[MAX_STREAMS];
+    uint32_t       encoded_size = 0;   // all streams
+    const uint8_t* encoded      = NULL;
+};
+
+// Appends the block for data[0..size) to out, size must be between 1 and STREAM_BLOCK_SIZE
+// and streams between 1 and MAX_STREAMS
+void encode_block(const uint8_t* data, size_t size, std::vector<uint8_t>& out, int streams = 1);
+
+// Reads the block at in[0..in_size). Returns the number of bytes it takes, or 0 when it is cut short or invalid.
+// block.encoded points into in
+size_t parse_block(const uint8_t* in, size_t in_size, block_info& block);
+
+// Decodes block.size bytes into out, returns false when a length in the table is invalid
+bool decode_block(const block_info& block, uint8_t* out);
+
+// numbers of the block layout, least significant byte first
+void     append_uint32(std::vector<uint8_t>& out, uint32_t value);
+uint32_t load_uint32(const uint8_t* p);
+
+}   // namespace huffman
@@ -0,0 +1,189 @@
+#include "huffman.hpp"
+
+#include "bit_reader.hpp"
+#include "bit_writer.hpp"
+#include "code_table.hpp"
+#include "histogram.hpp"
+#include "stream_format.hpp"
+
+#include <cstring>
+
+// Block codec of the library, shared by both engines and by the streaming mode of archive and extract
+
+namespace huffman {
+
+void append_uint32(std::vector<uint8_t>& out, uint32_t value) {
+    uint8_t bytes[4] = {(uint8_t)value, (uint8_t)(value >> 8), (uint8_t)(value >> 16), (uint8_t)(value >> 24)};
+    out.insert(out.end(), bytes, bytes + 4);
+}
+
+uint32_t load_uint32(const uint8_t* p) {
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static void store_uint32(uint8_t* p, uint32_t value) {
+    for (int i = 0; i < 4; i++) {
+        p[i] = value >> (8 * i);
+    }
+}
+
+static void append_stored(const uint8_t* data, size_t size, std::vector<uint8_t>& out) {
+    append_uint32(out, size | STREAM_STORED);
+    out.insert(out.end(), data, data + size);
+}
+
+void encode_block(const uint8_t* data, size_t size, std::vector<uint8_t>& out, int streams) {
+    long int      number[256] = {0};
+    unsigned char lengths[256];
+    count_bytes(data, size, number);
+    const size_t block_at = out.size();
+    if (bits_per_byte(number) >= STORED_ENTROPY) {
+        append_stored(data, size, out);
+        return;
+    }
+    huffman_code_lengths(number, lengths);
+    limit_code_lengths(lengths, number, MAX_CODE_LENGTH);
+    code_table codes;
+    codes.assign_canonical(lengths);
+
+    append_uint32(out, size | (streams > 1 ? STREAM_INTERLEAVED : 0));
+    size_t letter_count_at = out.size();
+    out.push_back(0);
+    int letter_count = 0;
+    for (int c = 0; c < 256; c++) {
+        if (number[c]) {
+            out.push_back(c);
+            out.push_back(lengths[c]);
+            letter_count++;
+        }
+    }
+    out[letter_count_at] = letter_count;   // 256 wraps around to 0
+
+    if (streams > 1) out.push_back(streams);
+
+    // the sizes are known once the block is encoded, their place is reserved first
+    size_t encoded_size_at = out.size();
+    append_uint32(out, 0);
+    for (int k = 0; k + 1 < streams; k++) {
+        append_uint32(out, 0);
+    }
+    size_t encoded_at = out.size();
+
+    std::vector<uint8_t> lane;   // bytes of one stream of an interleaved block
+    for (int k = 0; k < streams; k++) {
+        const uint8_t* input  = data;
+        size_t         length = size;
+        if (streams > 1) {
+            lane.clear();
+            for (size_t i = k; i < size; i += streams) {
+                lane.push_back(data[i]);
+            }
+            input  = lane.data();
+            length = lane.size();
+        }
+        size_t                  stream_at = out.size();
+        unsigned char           last_byte;
+        int                     last_bit_count;
+        bit_writer<vector_sink> writer(vector_sink{out}, 0, 0);
+        writer.encode(input, length, codes);
+        writer.finish(last_byte, last_bit_count);
+        if (last_bit_count) out.push_back(last_byte << (8 - last_bit_count));
+        if (k + 1 < streams) store_uint32(&out[encoded_size_at + 4 + 4 * k], out.size() - stream_at);
+    }
+    store_uint32(&out[encoded_size_at], out.size() - encoded_at);
+
+    // the table and the padding can still make a block larger than its input
+    if (out.size() - block_at > 4 + size) {
+        out.resize(block_at);
+        append_stored(data, size, out);
+    }
+}
+
+size_t parse_block(const uint8_t* in, size_t in_size, block_info& block) {
+    if (in_size < 4) return 0;
+    uint32_t size = load_uint32(in);
+    block.size    = size & ~(STREAM_INTERLEAVED | STREAM_STORED);
+    block.stored  = size & STREAM_STORED;
+    block.streams = 1;
+    if (!size) return 4;   // end of the stream
+    if (!block.size || block.size > STREAM_BLOCK_SIZE || in_size < 5) return 0;
+    if (block.stored) {
+        if (size & STREAM_INTERLEAVED || in_size - 4 < block.size) return 0;
+        block.encoded_size = block.size;
+        block.encoded      = in + 4;
+        return 4 + block.size;
+    }
+
+    block.letter_count = in[4] ? in[4] : 256;
+    size_t used        = 5 + 2 * block.letter_count;
+    if (in_size < used + 1) return 0;
+    memcpy(block.letters, in + 5, 2 * block.letter_count);
+    if (size & STREAM_INTERLEAVED) {
+        block.streams = in[used++];
+        if (block.streams < 2 || block.streams > MAX_STREAMS) return 0;
+    }
+    if (in_size < used + 4 * block.streams) return 0;
+    block.encoded_size = load_uint32(in + used);
+    used += 4;
+
+    // the last stream takes what the others leave
+    uint32_t rest = block.encoded_size;
+    for (int k = 0; k + 1 < block.streams; k++) {
+        block.stream_size[k] = load_uint32(in + used);
+        used += 4;
+        if (block.stream_size[k] > rest) return 0;
+        rest -= block.stream_size[k];
+    }
+    block.stream_size[block.streams - 1] = rest;
+
+    if (in_size - used < block.encoded_size) return 0;
+    block.encoded = in + used;
+    return used + block.encoded_size;
+}
+
+bool decode_block(const block_info& block, uint8_t* out) {
+    if (block.stored) {
+        memcpy(out, block.encoded, block.size);
+        return true;
+    }
+    unsigned char lengths[256] = {0};
+    for (int i = 0; i < block.letter_count; i++) {
+        if (block.letters[2 * i + 1] > MAX_CODE_LENGTH_LIMIT) return false;
+        lengths[block.letters[2 * i]] = block.letters[2 * i + 1];
+    }
+    code_table codes;
+    codes.assign_canonical(lengths);
+    std::vector<decode_table::code> table_codes;
+    for (int i = 0; i < block.letter_count; i++) {
+        unsigned char character = block.letters[2 * i];
+        table_codes.push_back(decode_table::code{codes.code[character], codes.length[character], character});
+    }
+    decode_table table;
+    table.build(table_codes);
+
+    if (block.streams == 1) {
+        bit_reader reader(block.encoded, block.encoded_size);
+        table.decode(reader, out, block.size);
+        return true;
+    }
+
+    std::vector<bit_reader> readers;
+    const uint8_t*          stream = block.encoded;
+    for (int k = 0; k < block.streams; k++) {
+        readers.push_back(bit_reader(stream, block.stream_size[k]));
+        stream += block.stream_size[k];
+    }
+    switch (block.streams) {
+    case 4: table.decode_interleaved<4>(readers.data(), out, block.size); break;
+    case 8: table.decode_interleaved<8>(readers.data(), out, block.size); break;
+    default:
+        for (uint32_t i = 0; i < block.size; i++) {
+            bit_reader& lane = readers[i % block.streams];
+            if (lane.avail < 32) lane.refill();
+            out[i] = table.decode(lane);
+        }
+    }
+    return true;
+}
+
+}   // namespace huffman
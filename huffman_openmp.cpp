@@ -0,0 +1,68 @@
+#include "huffman.hpp"
+
+#include "stream_format.hpp"
+
+#include <algorithm>
+#include <omp.h>
+
+// OpenMP engine of the library. Blocks do not depend on each other, so a batch of blocks is encoded (decoded)
+// on all threads and the results are written in order before the next batch, which keeps memory bounded
+// to BLOCKS_PER_THREAD blocks per thread. The output is the same as the one of the serial engine.
+
+namespace huffman {
+
+const int BLOCKS_PER_THREAD = 4;
+
+bool compress_parallel(const uint8_t* data, size_t size, output_sink& out, int streams) {
+    const long int                    block_count = (size + STREAM_BLOCK_SIZE - 1) / STREAM_BLOCK_SIZE;
+    const long int                    batch       = (long int)omp_get_max_threads() * BLOCKS_PER_THREAD;
+    std::vector<std::vector<uint8_t>> blocks;
+    for (long int first = 0; first < block_count; first += batch) {
+        blocks.resize(std::min(batch, block_count - first));
+#pragma omp parallel for schedule(dynamic)
+        for (long int i = 0; i < (long int)blocks.size(); i++) {
+            size_t offset = (first + i) * STREAM_BLOCK_SIZE;
+            blocks[i].clear();
+            encode_block(data + offset, std::min(STREAM_BLOCK_SIZE, size - offset), blocks[i], streams);
+        }
+        for (const std::vector<uint8_t>& block : blocks) {
+            if (!out.write(block.data(), block.size())) return false;
+        }
+    }
+    std::vector<uint8_t> end;
+    append_uint32(end, 0);
+    return out.write(end.data(), end.size());
+}
+
+// The block headers are read first (they give the place of every block), then each batch is decoded in parallel
+bool decompress_parallel(const uint8_t* data, size_t size, output_sink& out) {
+    std::vector<block_info> blocks;
+    while (true) {
+        block_info block;
+        size_t     used = parse_block(data, size, block);
+        if (!used) return false;
+        if (!block.size) break;
+        blocks.push_back(block);
+        data += used;
+        size -= used;
+    }
+
+    const long int       batch = (long int)omp_get_max_threads() * BLOCKS_PER_THREAD;
+    std::vector<uint8_t> original;
+    for (long int first = 0; first < (long int)blocks.size(); first += batch) {
+        const long int count = std::min(batch, (long int)blocks.size() - first);
+        original.resize(count * STREAM_BLOCK_SIZE);
+        bool valid = true;
+#pragma omp parallel for schedule(dynamic) reduction(&& : valid)
+        for (long int i = 0; i < count; i++) {
+            valid = decode_block(blocks[first + i], original.data() + i * STREAM_BLOCK_SIZE) && valid;
+        }
+        if (!valid) return false;
+        for (long int i = 0; i < count; i++) {
+            if (!out.write(original.data() + i * STREAM_BLOCK_SIZE, blocks[first + i].size)) return false;
+        }
+    }
+    return true;
+}
+
+}   // namespace huffman
@@ -0,0 +1,139 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdio>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+// Read-only view of a whole input file, used by both passes of the compressors.
+// Regular files are mapped with mmap, so the histogram and the encoder read straight from the page cache
+// without copies or per-byte library calls. The kernel is told that the mapping is read sequentially
+// and that it may back it with huge pages.
+// Pipes, special files and files that cannot be mapped fall back to buffered reads into memory,
+// which also lets them be read by both passes.
+struct input_file {
+    const unsigned char*       data = NULL;
+    size_t                     size = 0;
+    void*                      mapping      = NULL;
+    size_t                     mapping_size = 0;
+    std::vector<unsigned char> buffer;
+
+    input_file() {}
+    input_file(const input_file&) = delete;
+    input_file& operator=(const input_file&) = delete;
+    ~input_file() { release(); }
+
+    bool open(const char* path) {
+        release();
+        int fd = ::open(path, O_RDONLY);
+        if (fd < 0) return false;
+
+        struct stat st;
+        if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+            void* p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p != MAP_FAILED) {
+                madvise(p, st.st_size, MADV_SEQUENTIAL);
+#ifdef MADV_HUGEPAGE
+                madvise(p, st.st_size, MADV_HUGEPAGE);
+#endif
+                mapping      = p;
+                mapping_size = st.st_size;
+                data         = (const unsigned char*)p;
+                size         = st.st_size;
+                ::close(fd);
+                return true;
+            }
+        }
+
+        // buffered fallback: read until end of file, the size is not known in advance for pipes
+        size_t  used = 0;
+        ssize_t n;
+        buffer.resize(64 * 1024);
+        while ((n = read(fd, buffer.data() + used, buffer.size() - used)) > 0) {
+            used += n;
+            if (used == buffer.size()) buffer.resize(2 * buffer.size());
+        }
+        ::close(fd);
+        if (n < 0) {
+            buffer.clear();
+            return false;
+        }
+        buffer.resize(used);
+        data = buffer.data();
+        size = used;
+        return true;
+    }
+
+    // takes over bytes that were already read into memory (see io_uring_batch.hpp)
+    void adopt(std::vector<unsigned char>& bytes) {
+        release();
+        buffer.swap(bytes);
+        data = buffer.data();
+        size = buffer.size();
+    }
+
+    void release() {
+        if (mapping) munmap(mapping, mapping_size);
+        mapping      = NULL;
+        mapping_size = 0;
+        buffer.clear();
+        buffer.shrink_to_fit();
+        data = NULL;
+        size = 0;
+    }
+};
+
+// Appends the whole input to out for stored files (see archive_format.hpp). The kernel copies mapped files
+// from the page cache to the output (copy_file_range, or sendfile where that is not supported between the two
+// file systems), whatever it could not copy is written from the mapping. out is flushed first and must be a
+// regular file, its stream position is moved past the copy
+inline bool copy_input(const input_file& input, const char* path, FILE* out) {
+    size_t done = 0;
+    int    fd   = input.mapping ? ::open(path, O_RDONLY) : -1;
+    if (fd >= 0) {
+        fflush(out);
+        off_t   offset = 0;
+        ssize_t n;
+        while (done < input.size && (n = copy_file_range(fd, &offset, fileno(out), NULL, input.size - done, 0)) > 0) {
+            done += n;
+        }
+        while (done < input.size && (n = sendfile(fileno(out), fd, &offset, input.size - done)) > 0) {
+            done += n;
+        }
+        ::close(fd);
+        fseek(out, 0, SEEK_END);
+    }
+    return fwrite(input.data + done, 1, input.size - done, out) == input.size - done;
+}
+
+// Writes all n bytes at offset of fd, without moving its file position
+inline bool pwrite_all(int fd, const unsigned char* p, size_t n, off_t offset) {
+    while (n) {
+        ssize_t written = pwrite(fd, p, n, offset);
+        if (written <= 0) return false;
+        p += written;
+        n -= written;
+        offset += written;
+    }
+    return true;
+}
+
+// copy_input to a given offset of out, for writers that place every part of the output themselves.
+// Mapped files are copied by the kernel with copy_file_range, whatever it could not copy is written from the mapping
+inline bool copy_input_at(const input_file& input, const char* path, int out, off_t offset) {
+    size_t done = 0;
+    int    fd   = input.mapping ? ::open(path, O_RDONLY) : -1;
+    if (fd >= 0) {
+        off_t   in_offset = 0;
+        ssize_t n;
+        while (done < input.size && (n = copy_file_range(fd, &in_offset, out, &offset, input.size - done, 0)) > 0) {
+            done += n;
+        }
+        ::close(fd);
+    }
+    return pwrite_all(out, input.data + done, input.size - done, offset);
+}
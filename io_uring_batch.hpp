@@ -0,0 +1,232 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <vector>
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#define HAVE_IO_URING 1
+#endif
+
+// Optional io_uring backend of the serial compressor for folders of many small files (--io-uring, see cli_options.hpp).
+// The files of a folder are stat'ed, opened, read and closed in batches of up to BATCH_FILES requests that the
+// kernel works on at the same time. A batch costs one io_uring_enter call instead of one system call per request
+// and file. It talks to the kernel through the raw system calls, so liburing is not needed. start() returns false
+// when the kernel headers, the kernel or a seccomp filter do not allow io_uring; the callers then use the POSIX calls.
+// If io_uring_enter fails later, the batch closes the files it opened and the ring, started() becomes false and
+// the callers use the POSIX calls from then on.
+//
+// Files up to SMALL_FILE_SIZE are read into memory by the batches. Larger files are still mapped (see input_file.hpp),
+// because the mapping costs the same few calls whatever the size is.
+
+const size_t   SMALL_FILE_SIZE = 64 * 1024;
+const unsigned BATCH_FILES     = 64;
+
+// what stat_names found for one name: the st_mode bits and the size, or a negative error number
+struct name_status {
+    int      error = 0;
+    unsigned mode  = 0;
+    uint64_t size  = 0;
+};
+
+struct io_uring_batch {
+#ifdef HAVE_IO_URING
+    int            fd = -1;
+    unsigned       entries = 0;
+    void*          sq_ring = MAP_FAILED;
+    void*          cq_ring = MAP_FAILED;
+    size_t         sq_ring_size = 0, cq_ring_size = 0;
+    io_uring_sqe*  sqes = (io_uring_sqe*)MAP_FAILED;
+    unsigned *     sq_tail, *sq_mask, *sq_array;
+    unsigned *     cq_head, *cq_tail, *cq_mask;
+    io_uring_cqe*  cqes;
+    unsigned       queued = 0;   // entries prepared since the last run()
+    std::vector<int> results;   // res of every entry of the last run, by user_data
+
+    io_uring_batch() {}
+    io_uring_batch(const io_uring_batch&) = delete;
+    io_uring_batch& operator=(const io_uring_batch&) = delete;
+    ~io_uring_batch() { stop(); }
+
+    bool start(unsigned depth = 2 * BATCH_FILES) {
+        io_uring_params params;
+        memset(&params, 0, sizeof(params));
+        fd = syscall(__NR_io_uring_setup, depth, &params);
+        if (fd < 0) return false;
+        entries      = params.sq_entries;
+        sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        if (params.features & IORING_FEAT_SINGLE_MMAP) sq_ring_size = cq_ring_size = std::max(sq_ring_size, cq_ring_size);
+        sq_ring = mmap(NULL, sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+        cq_ring = params.features & IORING_FEAT_SINGLE_MMAP
+                      ? sq_ring
+                      : mmap(NULL, cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        sqes = (io_uring_sqe*)mmap(NULL, entries * sizeof(io_uring_sqe), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+                                   IORING_OFF_SQES);
+        if (sq_ring == MAP_FAILED || cq_ring == MAP_FAILED || sqes == MAP_FAILED) {
+            stop();
+            return false;
+        }
+        char* sq = (char*)sq_ring;
+        char* cq = (char*)cq_ring;
+        sq_tail  = (unsigned*)(sq + params.sq_off.tail);
+        sq_mask  = (unsigned*)(sq + params.sq_off.ring_mask);
+        sq_array = (unsigned*)(sq + params.sq_off.array);
+        cq_head  = (unsigned*)(cq + params.cq_off.head);
+        cq_tail  = (unsigned*)(cq + params.cq_off.tail);
+        cq_mask  = (unsigned*)(cq + params.cq_off.ring_mask);
+        cqes     = (io_uring_cqe*)(cq + params.cq_off.cqes);
+        return true;
+    }
+
+    void stop() {
+        if (sqes != MAP_FAILED) munmap(sqes, entries * sizeof(io_uring_sqe));
+        if (cq_ring != MAP_FAILED && cq_ring != sq_ring) munmap(cq_ring, cq_ring_size);
+        if (sq_ring != MAP_FAILED) munmap(sq_ring, sq_ring_size);
+        if (fd >= 0) close(fd);
+        sqes    = (io_uring_sqe*)MAP_FAILED;
+        sq_ring = cq_ring = MAP_FAILED;
+        fd                = -1;
+    }
+
+    bool started() const { return fd >= 0; }
+
+    // next entry of the batch, its result will be results[user_data]
+    io_uring_sqe* prepare(int opcode, int file, unsigned long user_data) {
+        unsigned      tail = *sq_tail + queued;
+        io_uring_sqe* sqe  = &sqes[tail & *sq_mask];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode          = opcode;
+        sqe->fd              = file;
+        sqe->user_data       = user_data;
+        sq_array[tail & *sq_mask] = tail & *sq_mask;
+        queued++;
+        return sqe;
+    }
+
+    // Submits the prepared entries and waits for all of them, results has room for user_data below count.
+    // When io_uring_enter fails, the completions that are already there are still put in results (entries that
+    // did not complete keep -ECANCELED), then the ring is closed, which drops what was not submitted and cancels
+    // what is still running, and false is returned
+    bool run(size_t count) {
+        results.assign(count, -ECANCELED);
+        __atomic_store_n(sq_tail, *sq_tail + queued, __ATOMIC_RELEASE);
+        unsigned submit = queued, waiting = queued;
+        queued          = 0;
+        while (waiting) {
+            long submitted = syscall(__NR_io_uring_enter, fd, submit, waiting, IORING_ENTER_GETEVENTS, NULL, 0);
+            bool failed    = submitted < 0 && errno != EINTR;
+            if (submitted > 0) submit -= submitted;
+            waiting -= reap(count);
+            if (failed) {
+                stop();
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // moves the completions in the ring to results and returns their number
+    unsigned reap(size_t count) {
+        unsigned head = *cq_head;
+        unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+        unsigned done = tail - head;
+        for (; head != tail; head++) {
+            const io_uring_cqe& cqe = cqes[head & *cq_mask];
+            if (cqe.user_data < count) results[cqe.user_data] = cqe.res;
+        }
+        __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+        return done;
+    }
+
+    // Type and size of every name of the folder dir (statx follows symbolic links like open does)
+    bool stat_names(int dir, const std::vector<std::string>& names, std::vector<name_status>& out) {
+        if (!started()) return false;
+        struct statx buffers[BATCH_FILES];
+        out.resize(names.size());
+        for (size_t first = 0; first < names.size(); first += BATCH_FILES) {
+            size_t count = std::min<size_t>(BATCH_FILES, names.size() - first);
+            for (size_t i = 0; i < count; i++) {
+                io_uring_sqe* sqe = prepare(IORING_OP_STATX, dir, i);
+                sqe->addr         = (unsigned long)names[first + i].c_str();
+                sqe->len          = STATX_TYPE | STATX_SIZE;
+                sqe->off          = (unsigned long)&buffers[i];
+            }
+            if (!run(count)) return false;
+            for (size_t i = 0; i < count; i++) {
+                out[first + i].error = results[i] < 0 ? results[i] : 0;
+                out[first + i].mode  = buffers[i].stx_mode;
+                out[first + i].size  = buffers[i].stx_size;
+            }
+        }
+        return true;
+    }
+
+    // Reads the whole files names[i] of the folder dir (at most BATCH_FILES, sizes from stat_names) into out[i]:
+    // every file is opened in a first batch, then read and closed in a second one (the close is hard linked to
+    // the read, so it runs after the read even when the read fails or is short). A file that cannot be read
+    // gets a negative error number in results[i]. If a batch fails, the files that were opened and not closed
+    // by the ring are closed here
+    bool read_files(int dir, const std::vector<const char*>& names, const std::vector<size_t>& sizes,
+                    std::vector<std::vector<unsigned char>>& out) {
+        if (!started()) return false;
+        const size_t count = names.size();
+        for (size_t i = 0; i < count; i++) {
+            io_uring_sqe* sqe = prepare(IORING_OP_OPENAT, dir, i);
+            sqe->addr         = (unsigned long)names[i];
+            sqe->open_flags   = O_RDONLY | O_CLOEXEC;
+        }
+        if (!run(count)) {
+            for (int file : results) {
+                if (file >= 0) close(file);
+            }
+            return false;
+        }
+        std::vector<int> files(results);
+
+        out.resize(count);
+        for (size_t i = 0; i < count; i++) {
+            if (files[i] < 0) continue;
+            out[i].resize(sizes[i]);
+            io_uring_sqe* read = prepare(IORING_OP_READ, files[i], i);
+            read->addr         = (unsigned long)out[i].data();
+            read->len          = sizes[i];
+            read->off          = 0;
+            read->flags        = IOSQE_IO_HARDLINK;
+            prepare(IORING_OP_CLOSE, files[i], count + i);   // its result only tells whether it ran
+        }
+        if (!run(2 * count)) {
+            for (size_t i = 0; i < count; i++) {
+                if (files[i] >= 0 && results[count + i] == -ECANCELED) close(files[i]);
+            }
+            return false;
+        }
+        for (size_t i = 0; i < count; i++) {
+            if (files[i] < 0) {
+                results[i] = files[i];
+            } else if (results[i] >= 0) {
+                out[i].resize(results[i]);
+            }
+        }
+        return true;
+    }
+#else
+    std::vector<int> results;
+
+    bool start(unsigned = 0) { return false; }
+    bool started() const { return false; }
+    bool stat_names(int, const std::vector<std::string>&, std::vector<name_status>&) { return false; }
+    bool read_files(int, const std::vector<const char*>&, const std::vector<size_t>&, std::vector<std::vector<unsigned char>>&) {
+        return false;
+    }
+#endif
+};
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <cstdio>
+#include <ctime>
+#include <string>
+
+// Per phase instrumentation of the compressors (--timing, see cli_options.hpp).
+// The main thread moves from phase to phase with enter() (never inside a parallel region), the wall clock and
+// the CPU time of the whole process (all threads) since the last switch are added to the phase that is left.
+// CPU time higher than wall time means the phase ran on several threads. Bytes are added by the code of every phase, so the report
+// can give the throughput of the phase. Nothing is measured when the timer is not enabled.
+// Threads that work while the main thread is in another phase (the writer threads, --pwrite tasks) measure their own
+// time with a thread_clock, which the main thread adds to the report once they are done.
+
+enum phase { PHASE_WALK, PHASE_HISTOGRAM, PHASE_TREE, PHASE_HEADER, PHASE_ENCODE, PHASE_MERGE, PHASE_WRITE, PHASE_COUNT, PHASE_NONE = -1 };
+
+const char* const PHASE_NAMES[PHASE_COUNT] = {"walk", "histogram", "tree", "header", "encode", "merge", "write"};
+
+inline double clock_seconds(clockid_t clock) {
+    timespec t;
+    clock_gettime(clock, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+// Wall clock and CPU time of one thread between start() and stop(p), added up per phase
+struct thread_clock {
+    bool   enabled;
+    double wall[PHASE_COUNT] = {0};
+    double cpu[PHASE_COUNT]  = {0};
+    double start_wall = 0, start_cpu = 0;
+
+    explicit thread_clock(bool on = false) : enabled(on) {}
+
+    void start() {
+        if (!enabled) return;
+        start_wall = clock_seconds(CLOCK_MONOTONIC);
+        start_cpu  = clock_seconds(CLOCK_THREAD_CPUTIME_ID);
+    }
+
+    void stop(int p) {
+        if (!enabled) return;
+        wall[p] += clock_seconds(CLOCK_MONOTONIC) - start_wall;
+        cpu[p] += clock_seconds(CLOCK_THREAD_CPUTIME_ID) - start_cpu;
+    }
+};
+
+struct phase_timer {
+    bool     enabled = false;
+    int      current = PHASE_NONE;
+    double   wall[PHASE_COUNT]  = {0};
+    double   cpu[PHASE_COUNT]   = {0};
+    long int bytes[PHASE_COUNT] = {0};
+    double   last_wall = 0, last_cpu = 0;
+    double   thread_wall = 0;   // wall time of other threads, it overlaps with the phases of the main thread
+
+    // closes the current phase and starts p (PHASE_NONE stops the clock, e.g. while waiting for the user)
+    void enter(int p) {
+        if (!enabled || p == current) return;
+        double now_wall = clock_seconds(CLOCK_MONOTONIC);
+        double now_cpu  = clock_seconds(CLOCK_PROCESS_CPUTIME_ID);
+        if (current != PHASE_NONE) {
+            wall[current] += now_wall - last_wall;
+            cpu[current] += now_cpu - last_cpu;
+        }
+        current   = p;
+        last_wall = now_wall;
+        last_cpu  = now_cpu;
+    }
+
+    // Adds the time another thread measured with clock, called by the main thread after that thread is done.
+    // The process clock counted its CPU time in the phase during of the main thread, it is moved from there to the
+    // phases of clock. Its wall time is the time the thread spent in a phase (added up over the threads of a pool),
+    // it is left out of the total
+    void add_thread_time(const thread_clock& clock, int during) {
+        if (!enabled) return;
+        for (int p = 0; p < PHASE_COUNT; p++) {
+            wall[p] += clock.wall[p];
+            cpu[p] += clock.cpu[p];
+            cpu[during] -= clock.cpu[p];
+            thread_wall += clock.wall[p];
+        }
+    }
+
+    // may be called from any thread
+    void add_bytes(int p, long int n) {
+        if (enabled) __atomic_fetch_add(&bytes[p], n, __ATOMIC_RELAXED);
+    }
+
+    // Writes the JSON report to destination ("" for standard error), returns false if it cannot be written
+    bool report(const char* program, int threads, long int input_bytes, long int output_bytes, const std::string& destination) {
+        enter(PHASE_NONE);
+        FILE* fp = destination.empty() ? stderr : fopen(destination.c_str(), "w");
+        if (!fp) return false;
+
+        double total_wall = 0, total_cpu = 0;
+        for (int p = 0; p < PHASE_COUNT; p++) {
+            total_wall += wall[p];
+            total_cpu += cpu[p];
+        }
+        total_wall -= thread_wall;
+        fprintf(fp, "{\n  \"program\": \"%s\",\n  \"threads\": %d,\n  \"input_bytes\": %ld,\n  \"output_bytes\": %ld,\n", program, threads,
+                input_bytes, output_bytes);
+        fprintf(fp, "  \"wall_seconds\": %.6f,\n  \"cpu_seconds\": %.6f,\n  \"phases\": [\n", total_wall, total_cpu);
+        for (int p = 0; p < PHASE_COUNT; p++) {
+            fprintf(fp, "    {\"name\": \"%s\", \"wall_seconds\": %.6f, \"cpu_seconds\": %.6f, \"bytes\": %ld, \"mb_per_second\": ", PHASE_NAMES[p],
+                    wall[p], cpu[p], bytes[p]);
+            if (bytes[p] && wall[p] > 0) {
+                fprintf(fp, "%.2f}", bytes[p] / wall[p] / (1024 * 1024));
+            } else {
+                fprintf(fp, "null}");
+            }
+            fprintf(fp, p + 1 < PHASE_COUNT ? ",\n" : "\n");
+        }
+        fprintf(fp, "  ]\n}\n");
+        return destination.empty() ? true : fclose(fp) == 0;
+    }
+};
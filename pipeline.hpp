@@ -0,0 +1,182 @@
+#pragma once
+
+#include "input_file.hpp"
+#include "phase_timer.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+// Reader / encoder / writer pipeline of the serial compressor for the content of large files (--pipeline, see cli_options.hpp).
+// The reader thread faults the pages of the mapped input in ahead of the encoder, so the encoder does not stop
+// on page faults while the disk is read, and the writer thread hands full output blocks to the compressed file
+// while the next ones are encoded. The encoder is the thread that owns the bit_writer.
+// Stages talk through bounded single producer / single consumer queues: a stage that is PIPELINE_DEPTH blocks
+// ahead waits for the next one (backpressure), so memory stays bounded and one core runs at the speed of the
+// slowest stage instead of the sum of all of them.
+// It can only pay off when the input is not in the page cache or the output device is slow. With a warm cache there
+// is nothing to overlap: the stages only add the hand-overs and one more copy of the output into the blocks of the
+// writer, so it is off by default.
+
+const size_t PIPELINE_BLOCK = 1024 * 1024;   // bytes of input (reader) or output (writer) in one block
+const int    PIPELINE_DEPTH = 4;             // blocks a stage may be ahead of the next one
+
+// waiting side of the queues: yields first, then sleeps so a stage that waits for a slow one leaves the core to it
+inline void pipeline_wait(int& spins) {
+    if (spins++ < 16) {
+        std::this_thread::yield();
+    } else {
+        std::this_thread::sleep_for(std::chrono::microseconds(200));
+    }
+}
+
+// Lock-free bounded queue between exactly one producer thread and one consumer thread
+template <class T, size_t N> class spsc_queue {
+    T                   slots[N];
+    std::atomic<size_t> head{0};   // next slot to pop, written by the consumer only
+    std::atomic<size_t> tail{0};   // next slot to push, written by the producer only
+
+  public:
+    bool try_push(const T& value) {
+        size_t t = tail.load(std::memory_order_relaxed);
+        if (t - head.load(std::memory_order_acquire) == N) return false;
+        slots[t % N] = value;
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool try_pop(T& value) {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire)) return false;
+        value = slots[h % N];
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    // blocking versions, they wait while the queue is full (empty)
+    void push(const T& value) {
+        for (int spins = 0; !try_push(value);) pipeline_wait(spins);
+    }
+    T pop() {
+        T value;
+        for (int spins = 0; !try_pop(value);) pipeline_wait(spins);
+        return value;
+    }
+};
+
+// Reader stage: asks the kernel to read the next block of the mapping and touches one byte of every page of it,
+// then tells the encoder which part of the input is in memory. Only mapped files need it, buffered files are read
+// whole when they are opened
+struct read_ahead {
+    const input_file&                  input;
+    spsc_queue<size_t, PIPELINE_DEPTH> ready;   // end of every block that is in memory
+    std::atomic<bool>                  stop{false};
+    size_t                             available = 0;   // encoder side: bytes known to be in memory
+    std::thread                        thread;
+
+    explicit read_ahead(const input_file& in) : input(in), thread([this] { run(); }) {}
+    ~read_ahead() {
+        stop = true;
+        thread.join();
+    }
+
+    // blocks until bytes [0, end) of the input are in memory
+    void wait(size_t end) {
+        while (available < end) available = ready.pop();
+    }
+
+  private:
+    void run() {
+        const size_t page = sysconf(_SC_PAGESIZE);
+        if (!input.mapping) {
+            ready.push(input.size);
+            return;
+        }
+        for (size_t done = 0; done < input.size && !stop;) {
+            size_t end = std::min(done + PIPELINE_BLOCK, input.size);
+            madvise((char*)input.mapping + done, end - done, MADV_WILLNEED);   // one read for the block when it is not cached
+            for (size_t i = done; i < end; i += page) {
+                (void)*(volatile const unsigned char*)(input.data + i);   // waits for the page
+            }
+            for (int spins = 0; !ready.try_push(end);) {
+                if (stop) return;
+                pipeline_wait(spins);
+            }
+            done = end;
+        }
+    }
+};
+
+// Writer stage: the encoder fills PIPELINE_BLOCK output blocks and the writer thread writes the full ones to fp
+// in order. fp must not be used by anyone else until finish() returns. The writer thread measures the time of its
+// fwrite calls with clock (the write phase of --timing)
+struct write_behind {
+    FILE*                           fp;
+    std::vector<unsigned char>      blocks[PIPELINE_DEPTH];
+    spsc_queue<int, PIPELINE_DEPTH> full;          // blocks to write in order, -1 stops the writer
+    spsc_queue<int, PIPELINE_DEPTH> free_blocks;   // blocks the encoder can fill again
+    int                             current;       // block the encoder is filling
+    size_t                          written = 0;   // bytes written by the writer thread
+    bool                            failed  = false;   // an fwrite call wrote less than its block
+    thread_clock                    clock;
+    std::thread                     thread;
+
+    write_behind(FILE* f, bool timed) : fp(f), clock(timed) {
+        for (int k = 0; k < PIPELINE_DEPTH; k++) {
+            blocks[k].reserve(PIPELINE_BLOCK);
+            free_blocks.push(k);
+        }
+        current = free_blocks.pop();
+        thread  = std::thread([this] { run(); });
+    }
+    ~write_behind() {
+        if (thread.joinable()) finish();
+    }
+
+    // encoder side, waits for a free block when the writer is PIPELINE_DEPTH blocks behind
+    void write(const unsigned char* p, size_t n) {
+        while (n) {
+            std::vector<unsigned char>& block = blocks[current];
+            size_t                      take  = std::min(n, PIPELINE_BLOCK - block.size());
+            block.insert(block.end(), p, p + take);
+            p += take;
+            n -= take;
+            if (block.size() == PIPELINE_BLOCK) {
+                full.push(current);
+                current = free_blocks.pop();
+            }
+        }
+    }
+
+    // hands the last block to the writer and waits until everything is written,
+    // returns false if the compressed file could not be written (e.g. the disk is full)
+    bool finish() {
+        if (!blocks[current].empty()) full.push(current);
+        full.push(-1);
+        thread.join();
+        return !failed;
+    }
+
+  private:
+    void run() {
+        for (int k; (k = full.pop()) >= 0;) {
+            if (!failed) {     // blocks after a failed write are still taken, so the encoder does not wait for them
+                clock.start();
+                failed = fwrite(blocks[k].data(), 1, blocks[k].size(), fp) != blocks[k].size();
+                clock.stop(PHASE_WRITE);
+                written += blocks[k].size();
+            }
+            blocks[k].clear();
+            free_blocks.push(k);
+        }
+    }
+};
+
+// bit_writer sink of the encoder stage
+struct write_behind_sink {
+    write_behind* output;
+    void          write(const unsigned char* p, size_t n) { output->write(p, n); }
+};
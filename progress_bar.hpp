@@ -1,32 +1,60 @@
+#include<atomic>
+#include<chrono>
 #include<iostream>
+#include<mutex>
+#include<unistd.h>
 
 struct progress{
     // this struct is here for maintaining progress bar feature
     // it doesn't have any additional function
     // It isn't neccessary for the program
-    long int MAX=0,CURRENT=0,LAST=0;
-    int percentage=0;
-    
+        // add() may be called from any thread, the bar is redrawn in place with ANSI codes
+        // at most once every REDRAW_INTERVAL and only when the percentage changes.
+        // A thread that finds another one drawing just skips its redraw
+    static const int REDRAW_INTERVAL_MS=100;
+
+    std::atomic<long int> MAX{0},CURRENT{0};
+    std::atomic<int> percentage{0};
+    bool enabled=isatty(STDERR_FILENO);     //escape codes are only useful on a terminal
+    bool drawn=false;
+    std::chrono::steady_clock::time_point last_draw;
+    std::mutex drawing;
+
+    void add(long int a){
+        CURRENT+=a;
+        update();
+    }
     void update(){
-        if(CURRENT*100/MAX>percentage){
-            percentage=CURRENT*100/MAX;
+        if(!enabled||MAX<=0)return;
+        long int p=CURRENT*100/MAX;
+        if(p>100)p=100;
+        if(p<=percentage)return;        //cheap check without the lock, most calls end here
+        if(!drawing.try_lock())return;
+        auto now=std::chrono::steady_clock::now();
+        if(p>percentage&&(p==100||!drawn||now-last_draw>=std::chrono::milliseconds(REDRAW_INTERVAL_MS))){
+            percentage=p;
+            last_draw=now;
             BAR();
         }
+        drawing.unlock();
     }
-    void current(long int a){
-        CURRENT=a;
-        update();
-    }
-    void next(long int a){
-        CURRENT+=LAST;
-        LAST=a;
-        update();
+    // draws the final state and moves to the next line, call it once the work is done
+    void finish(){
+        if(!enabled||!drawn)return;
+        std::lock_guard<std::mutex> lock(drawing);
+        percentage=100;
+        BAR();
+        std::cerr<<std::endl;
+        drawn=false;
     }
     void BAR(){
-        system("clear");
-        std::cout<<'[';
-        for(int i=1;i<=percentage;i++)std::cout<<'#';
-        for(int i=1;i<=100-percentage;i++)std::cout<<':';
-        std::cout<<"]:%"<<percentage<<std::endl;
+        char line[112];
+        int p=percentage;
+        line[0]='[';
+        for(int i=1;i<=100;i++)line[i]=i<=p?'#':':';
+        line[101]=']';
+        line[102]=0;
+        std::cerr<<"\r\033[2K"<<line<<":%"<<p<<std::flush;     //carriage return and erase line instead of clearing the screen
+        drawn=true;
     }
 };
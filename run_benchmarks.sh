@@ -153,7 +153,7 @@ run_test() {
     
     # Run original compression to get size
     rm -f "${input_file}.compressed" 2>/dev/null
-    if ! ./build/archive "$input_file" < <(echo -e "0\n1") > /dev/null 2>&1; then
+    if ! ./build/archive --batch "$input_file" > /dev/null 2>&1; then
         echo -e "${RED}Warning: Original compression failed${NC}" >&2
         return 1
     fi
@@ -161,7 +161,7 @@ run_test() {
     rm -f "${input_file}.compressed" 2>/dev/null
 
     # Run parallel compression to get size
-    if ! ./build/modified_archive "$input_file" < <(echo -e "0\n1") > /dev/null 2>&1; then
+    if ! ./build/modified_archive --batch "$input_file" > /dev/null 2>&1; then
         echo -e "${RED}Warning: Parallel compression failed${NC}" >&2
         return 1
     fi
@@ -182,7 +182,7 @@ run_test() {
     
     # Measure system-level performance
     local time_output
-    time_output=$(TIMEFORMAT='%R %U %S'; { time ./build/modified_archive "$input_file" < <(echo -e "0\n1") ; } 2>&1 >/dev/null)
+    time_output=$(TIMEFORMAT='%R %U %S'; { time ./build/modified_archive --batch "$input_file" ; } 2>&1 >/dev/null)
     
     # Parse time command output
     local real_time=$(echo "$time_output" | awk '{print $1}')
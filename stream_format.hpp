@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+
+// Layout of the streaming mode (archive --stream, extract --stream).
+// Input is cut into blocks of STREAM_BLOCK_SIZE bytes and every block is written with its own table,
+// so a block is encoded as soon as it is read and memory use does not depend on the input size.
+//
+// block (repeated)
+//     1 (4 bytes)             ->  size of the original block, 0 marks the end of the stream
+//     2 (one byte)            ->  letter_count of the block (256 wraps around to 0)
+//     3 (2 bytes per letter)  ->  unique byte and the length of its transformation (canonical, see code_table.hpp)
+//     4 (4 bytes)             ->  size of the transformed block in bytes
+//     5 (bytes)               ->  transformed version of the block, last byte padded with zeros
+//
+// numbers are written least significant byte first
+//
+// Interleaved blocks (archive --stream --interleave, huffman::compress with streams > 1) have STREAM_INTERLEAVED set
+// in 1 and split the block round robin into N independent bitstreams (byte i goes to stream i % N), so a decoder
+// can follow N streams at once instead of waiting for the length of every code before it finds the next one:
+//
+//     1 (4 bytes)             ->  size of the original block | STREAM_INTERLEAVED
+//     2, 3                    ->  same as above (one table for all streams)
+//     3.1 (one byte)          ->  N, number of streams (2 to MAX_STREAMS)
+//     4 (4 bytes)             ->  size of all transformed streams in bytes
+//     4.1 (4 bytes * (N-1))   ->  size of the streams 0 to N-2, the last stream takes the rest
+//     5 (bytes)               ->  the streams one after the other, each padded with zeros to a whole byte
+//
+// Stored blocks (random or already compressed input, see STORED_ENTROPY in histogram.hpp) have STREAM_STORED set in 1
+// and hold the original bytes instead of 2 to 5, so a block never grows by more than its 4 byte size:
+//
+//     1 (4 bytes)             ->  size of the original block | STREAM_STORED
+//     2 (bytes)               ->  the original block
+
+const size_t   STREAM_BLOCK_SIZE  = 1024 * 1024;
+const uint32_t STREAM_INTERLEAVED = 0x80000000u;   // flags in the size of a block, sizes are at most STREAM_BLOCK_SIZE
+const uint32_t STREAM_STORED      = 0x40000000u;
+const int      MAX_STREAMS        = 16;
+
+inline void write_uint32(FILE* fp, uint32_t value) {
+    unsigned char bytes[4] = {(unsigned char)value, (unsigned char)(value >> 8), (unsigned char)(value >> 16), (unsigned char)(value >> 24)};
+    fwrite(bytes, 1, 4, fp);
+}
+
+inline bool read_uint32(FILE* fp, uint32_t& value) {
+    unsigned char bytes[4];
+    if (fread(bytes, 1, 4, fp) != 4) return false;
+    value = bytes[0] | bytes[1] << 8 | bytes[2] << 16 | (uint32_t)bytes[3] << 24;
+    return true;
+}
@@ -0,0 +1,141 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Work-stealing thread pool of modified_archive, created once and shared by the walk and both passes.
+// Every thread has its own queue. Tasks spawned by a task go to the back of the queue of its thread, tasks spawned
+// from outside of the pool (the main thread between batches) are dealt round robin over all queues. A thread takes
+// tasks from the front of its own queue first and steals from the front of the others when it runs out, so every
+// thread starts on its own share of a batch and the batch is taken in about the order it was spawned (the callers
+// spawn the largest tasks first: longest processing time first). The main thread is thread 0, it runs tasks while it
+// waits for a batch. Threads that find no task anywhere sleep until the next spawn.
+class task_pool {
+    struct task_queue {
+        std::mutex                        lock;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    std::unique_ptr<task_queue[]> queues;
+    std::vector<std::thread>      threads;
+    int                           count;
+    std::mutex                    idle_lock;
+    std::condition_variable       idle;
+    std::atomic<long int>         queued{0};       // tasks in the queues
+    std::atomic<long int>         unfinished{0};   // tasks spawned and not finished yet
+    std::atomic<unsigned>         next_queue{0};   // queue of the next task spawned from outside of the pool
+    bool                          stopping = false;
+
+    static int& current() {
+        static thread_local int index = 0;   // threads outside of the pool use queue 0 like the main thread
+        return index;
+    }
+
+    static bool& in_task() {
+        static thread_local bool running = false;   // the thread is running a task of the pool
+        return running;
+    }
+
+    bool take(int self, std::function<void()>& task) {
+        for (int k = 0; k < count; k++) {
+            task_queue& queue = queues[(self + k) % count];
+            std::lock_guard<std::mutex> guard(queue.lock);
+            if (queue.tasks.empty()) continue;
+            task = std::move(queue.tasks.front());
+            queue.tasks.pop_front();
+            queued--;
+            return true;
+        }
+        return false;
+    }
+
+    bool run_one(int self) {
+        std::function<void()> task;
+        if (!take(self, task)) return false;
+        in_task() = true;
+        task();
+        in_task() = false;
+        if (--unfinished == 0) {
+            { std::lock_guard<std::mutex> guard(idle_lock); }
+            idle.notify_all();
+        }
+        return true;
+    }
+
+    void work(int self) {
+        current() = self;
+        while (true) {
+            if (run_one(self)) continue;
+            std::unique_lock<std::mutex> guard(idle_lock);
+            idle.wait(guard, [&] { return stopping || queued > 0; });
+            if (stopping) return;
+        }
+    }
+
+  public:
+    explicit task_pool(int threads_count) : queues(new task_queue[std::max(1, threads_count)]), count(std::max(1, threads_count)) {
+        for (int i = 1; i < count; i++) {
+            threads.emplace_back([this, i] { work(i); });
+        }
+    }
+    task_pool(const task_pool&) = delete;
+    task_pool& operator=(const task_pool&) = delete;
+    ~task_pool() {
+        {
+            std::lock_guard<std::mutex> guard(idle_lock);
+            stopping = true;
+        }
+        idle.notify_all();
+        for (std::thread& thread : threads) thread.join();
+    }
+
+    int size() const { return count; }
+
+    // index of the calling thread in [0, size()), for per thread buffers
+    int worker() const { return current(); }
+
+    // may be called from any task and from outside of the pool, the task runs on whichever thread takes it first
+    void spawn(std::function<void()> task) {
+        unfinished++;
+        {
+            const bool                  own   = current() != 0 || in_task();
+            task_queue&                 queue = queues[own ? current() : next_queue++ % count];
+            std::lock_guard<std::mutex> guard(queue.lock);
+            queue.tasks.push_back(std::move(task));
+        }
+        queued++;
+        { std::lock_guard<std::mutex> guard(idle_lock); }
+        idle.notify_one();
+    }
+
+    // Main thread: runs tasks until every spawned task (and every task they spawned) is finished.
+    // It waits for all tasks of the pool, including the one that would call it, so it must not be called from a task
+    void wait() {
+        assert(current() == 0 && !in_task());
+        while (unfinished > 0) {
+            if (run_one(0)) continue;
+            std::unique_lock<std::mutex> guard(idle_lock);
+            idle.wait(guard, [&] { return unfinished == 0 || queued > 0; });
+        }
+    }
+
+    // Calls body(i) for every i in [0, n) in increasing order of start on all threads and waits, for loops whose
+    // iterations wait for earlier ones (the output ring of modified_archive)
+    template <class F> void for_each_in_order(long int n, F body) {
+        std::atomic<long int> next{0};
+        for (int t = 0; t < count; t++) {
+            spawn([&] {
+                for (long int i; (i = next++) < n;) body(i);
+            });
+        }
+        wait();
+    }
+};
@@ -1,17 +1,40 @@
+#include "huffman.hpp"
+
 #include <algorithm>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <dirent.h>
 #include <fstream>
 #include <iomanip>
 #include <iostream>
 #include <omp.h>
+#include <random>
 #include <string>
+#include <sys/stat.h>
+#include <unistd.h>
 #include <vector>
 
+// Header, code lengths and index of an archive of one file, without its path and the CRC32C and seek point of every MB.
+// Incompressible files are stored and no code is longer on average than the 8 bits of a stored byte, so no archive of
+// one file is larger than its input plus this, the path, the checksums and the seek points
+const long MAX_ARCHIVE_OVERHEAD = 4096;
+
 void        compress_original(const char* input_file, const char* output_file, double& time_taken);
 void        compress_modified(const char* input_file, const char* output_file, double& time_taken);
+void        time_codec(const char* input_file);
+bool        round_trip(const char* input_path, const char* compressed_file, const std::vector<std::string>& paths = {});
+bool        list_check(const char* input_path, const char* compressed_file);
+bool        range_check(const char* input_path, const char* seek_option);
+bool        verify_check(const char* input_path, const char* compressed_file);
+bool        options_check(const char* input_path, const std::string& archive_options, const std::string& modified_options, bool bounded);
+bool        within_stored_size(const char* input_path, long compressed_size);
+bool        stream_round_trip(const char* input_path, const char* options);
+bool        unsafe_path_check();
+void        make_test_tree(const char* folder);
 bool        compare_files(const char* file1, const char* file2);
+bool        compare_paths(const std::string& path1, const std::string& path2);
+void        list_paths(const std::string& path, std::vector<std::string>& entries);
 std::string get_base_name(const char* file_path);
 long        get_file_size(const char* file_path);
 
@@ -28,6 +51,7 @@ int main(int argc, char* argv[]) {
     std::vector<long>        original_sizes;
     std::vector<long>        modified_sizes;
     std::vector<long>        input_sizes;
+    int                      failures = 0;
 
     for (int i = 1; i < argc; ++i) {
         const char* input_file = argv[i];
@@ -67,6 +91,11 @@ int main(int argc, char* argv[]) {
             std::cout << "Test file: " << input_file << " - Compressed files are identical." << std::endl;
         } else {
             std::cout << "Test file: " << input_file << " - Compressed files differ." << std::endl;
+            failures++;
+        }
+        if (!within_stored_size(input_file, modified_size)) {
+            std::cout << "Test file: " << input_file << " - Compressed file is larger than the stored input." << std::endl;
+            failures++;
         }
 
         // Output detailed report for this file only
@@ -80,27 +109,72 @@ int main(int argc, char* argv[]) {
                   << original_times[i - 1] << std::setw(20) << modified_times[i - 1] << std::setw(10) << std::fixed << std::setprecision(2)
                   << speedup << std::setw(15) << std::setprecision(4) << compression_ratio_original << std::setw(15)
                   << compression_ratio_modified << std::endl;
+
+        // Same input through libhuffman, without process startup and file system work
+        time_codec(input_file);
+
+        // Extract the archive again and compare every byte with the input
+        if (!round_trip(input_file, output_modified.c_str())) failures++;
+        for (const char* options : {"--stream", "--stream --interleave", "--stream --interleave=8"}) {
+            if (!stream_round_trip(input_file, options)) failures++;
+        }
+        if (!range_check(input_file, "--seek=64")) failures++;
+        if (!verify_check(input_file, output_modified.c_str())) failures++;
+
+        // Options that change how the bytes reach the encoder must give the same archive as a plain run would extract
+        if (!options_check(input_file, "--table=text", "--table=text", true)) failures++;
+        std::string train = std::string("./build/archive --train=round_trip.huft \"") + input_file + "\" > /dev/null";
+        if (system(train.c_str()) || !options_check(input_file, "--table=round_trip.huft", "--table=round_trip.huft", true)) {
+            failures++;
+        }
+        remove("round_trip.huft");
+        for (const char* threads : {"1", "3", "8"}) {
+            if (!options_check(input_file, "", std::string("OMP_NUM_THREADS=") + threads + " --pwrite", false)) failures++;
+        }
+        if (!options_check(input_file, "--seek=64", "OMP_NUM_THREADS=3 --pwrite --seek=64", false)) failures++;
+        if (!options_check(input_file, "--pipeline", "", false)) failures++;   // files of more than 1MB
+        if (!options_check(input_file, "", "OMP_NUM_THREADS=3 --memory=1", false)) failures++;   // smallest output ring
     }
 
-    return 0;
+    // Folder tree with nested folders, an empty folder, empty, one letter, text and stored (random) files, a long path
+    // and a folder of many files
+    const char* tree = "round_trip_tree";
+    make_test_tree(tree);
+    double      time_original = 0.0, time_modified = 0.0;
+    compress_original(tree, "original_round_trip_tree.compressed", time_original);
+    compress_modified(tree, "modified_round_trip_tree.compressed", time_modified);
+    if (!compare_files("original_round_trip_tree.compressed", "modified_round_trip_tree.compressed")) {
+        std::cout << "Test folder: " << tree << " - Compressed files differ." << std::endl;
+        failures++;
+    }
+    if (!round_trip(tree, "modified_round_trip_tree.compressed")) failures++;
+    if (!list_check(tree, "modified_round_trip_tree.compressed")) failures++;
+    if (!verify_check(tree, "modified_round_trip_tree.compressed")) failures++;
+    if (!round_trip(tree, "modified_round_trip_tree.compressed", {"round_trip_tree/sub/deeper", "round_trip_tree/empty_file"})) failures++;
+    if (!round_trip(tree, "modified_round_trip_tree.compressed", {"round_trip_tree/sub/text.txt"})) failures++;
+    if (!round_trip(tree, "modified_round_trip_tree.compressed", {"round_trip_tree/" + std::string(250, 'n'), "round_trip_tree/many_files"})) {
+        failures++;
+    }
+    for (const char* threads : {"1", "3", "8"}) {
+        if (!options_check(tree, "", std::string("OMP_NUM_THREADS=") + threads + " --pwrite", false)) failures++;
+    }
+    if (!options_check(tree, "--seek=64", "OMP_NUM_THREADS=3 --pwrite --seek=64", false)) failures++;
+    if (!options_check(tree, "--io-uring", "", false)) failures++;   // batches of small files (many_files)
+    if (!options_check(tree, "", "OMP_NUM_THREADS=3 --memory=1", false)) failures++;
+    system((std::string("rm -rf \"") + tree + "\"").c_str());
+
+    if (!unsafe_path_check()) failures++;
+
+    return failures ? 1 : 0;
 }
 
 void compress_original(const char* input_file, const char* output_file, double& time_taken) {
     double start_time = omp_get_wtime();
 
-    // Write the inputs to a temporary file
-    std::string   temp_input_file = "temp_input.txt";
-    std::ofstream temp_input(temp_input_file);
-    temp_input << "0\n1\n";
-    temp_input.close();
-
-    // Use input redirection to supply inputs to the compressor
-    std::string command = "./build/archive \"" + std::string(input_file) + "\" < " + temp_input_file;
+    // Batch mode: no password, no confirmation prompt and no progress bar
+    std::string command = "./build/archive --batch \"" + std::string(input_file) + "\"";
     int         ret     = system(command.c_str());
 
-    // Remove the temporary input file
-    std::remove(temp_input_file.c_str());
-
     double end_time = omp_get_wtime();
     time_taken      = end_time - start_time;
     if (ret != 0) {
@@ -118,19 +192,10 @@ void compress_original(const char* input_file, const char* output_file, double&
 void compress_modified(const char* input_file, const char* output_file, double& time_taken) {
     double start_time = omp_get_wtime();
 
-    // Write the inputs to a temporary file
-    std::string   temp_input_file = "temp_input.txt";
-    std::ofstream temp_input(temp_input_file);
-    temp_input << "0\n1\n";
-    temp_input.close();
-
-    // Use input redirection to supply inputs to the compressor
-    std::string command = "./build/modified_archive \"" + std::string(input_file) + "\" < " + temp_input_file;
+    // Batch mode: no password, no confirmation prompt and no progress bar
+    std::string command = "./build/modified_archive --batch \"" + std::string(input_file) + "\"";
     int         ret     = system(command.c_str());
 
-    // Remove the temporary input file
-    std::remove(temp_input_file.c_str());
-
     double end_time = omp_get_wtime();
     time_taken      = end_time - start_time;
     if (ret != 0) {
@@ -145,6 +210,283 @@ void compress_modified(const char* input_file, const char* output_file, double&
     }
 }
 
+// Times compress() of both engines and a parallel decompress() on the file loaded in memory
+void time_codec(const char* input_file) {
+    std::ifstream        file(input_file, std::ios::binary);
+    std::vector<uint8_t> input((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+    std::vector<uint8_t>         serial_output, parallel_output, round_trip;
+    huffman::vector_output_sink serial_sink(serial_output), parallel_sink(parallel_output), round_trip_sink(round_trip);
+
+    double start_time = omp_get_wtime();
+    huffman::compress(input.data(), input.size(), serial_sink, huffman::engine::serial);
+    double serial_time = omp_get_wtime() - start_time;
+
+    start_time = omp_get_wtime();
+    huffman::compress(input.data(), input.size(), parallel_sink, huffman::engine::parallel);
+    double parallel_time = omp_get_wtime() - start_time;
+
+    start_time = omp_get_wtime();
+    bool   valid = huffman::decompress(parallel_output.data(), parallel_output.size(), round_trip_sink, huffman::engine::parallel);
+    double decompress_time = omp_get_wtime() - start_time;
+    valid                  = valid && round_trip == input && serial_output == parallel_output;
+
+    std::cout << "Codec Report (libhuffman, in memory):\n";
+    std::cout << std::left << std::setw(20) << get_base_name(input_file) << std::right << std::setw(15) << input.size() << std::setw(15)
+              << parallel_output.size() << std::setw(20) << serial_time << std::setw(20) << parallel_time << std::setw(20)
+              << decompress_time << std::setw(10) << (valid ? "ok" : "FAILED") << std::endl;
+}
+
+// Extracts compressed_file in an empty folder and compares the result with input_path byte by byte. extract writes
+// every file under the path it was archived with, so only relative paths inside the working folder can be checked:
+// extract refuses the others (see unsafe_path_check). With paths, only these files and folders of the archive are
+// extracted, and no other file may be written
+bool round_trip(const char* input_path, const char* compressed_file, const std::vector<std::string>& paths) {
+    const std::string folder = "round_trip.tmp";
+    const std::string input(input_path);
+    if (input[0] == '/' || input == ".." || input.compare(0, 3, "../") == 0 || input.find("/../") != std::string::npos) {
+        std::cout << "Round trip: " << input_path << " - skipped (not a relative path inside the working folder)" << std::endl;
+        return true;
+    }
+    std::string archive(compressed_file);
+    if (archive[0] != '/') archive = "../" + archive;
+
+    std::string command = "rm -rf " + folder + " && mkdir " + folder + " && cd " + folder + " && ../build/extract -n \"" + archive + "\"";
+    std::string name    = paths.empty() ? input : "";
+    for (const std::string& path : paths) {
+        command += " \"" + path + "\"";
+        name += (name.empty() ? "" : " ") + path;
+    }
+    bool valid = system((command + " > /dev/null").c_str()) == 0;
+    if (paths.empty()) {
+        valid = valid && compare_paths(input, folder + "/" + input);
+    } else {
+        std::vector<std::string> expected, extracted;
+        for (const std::string& path : paths) {
+            valid = valid && compare_paths(path, folder + "/" + path);
+            list_paths(path, expected);
+        }
+        list_paths(folder + "/" + input, extracted);
+        auto folder_entry = [](const std::string& entry) { return entry.back() == '/'; };
+        expected.erase(std::remove_if(expected.begin(), expected.end(), folder_entry), expected.end());
+        extracted.erase(std::remove_if(extracted.begin(), extracted.end(), folder_entry), extracted.end());
+        valid = valid && expected.size() == extracted.size();
+    }
+    system(("rm -rf " + folder).c_str());
+
+    std::cout << "Round trip: " << name << " - " << (valid ? "ok" : "FAILED") << std::endl;
+    return valid;
+}
+
+// Compares the output of extract --list with the files (size and path) and folders (path and '/') of input_path
+bool list_check(const char* input_path, const char* compressed_file) {
+    std::vector<std::string> expected, listed;
+    list_paths(input_path, expected);
+
+    std::string command = "./build/extract --list \"" + std::string(compressed_file) + "\" > round_trip_list.tmp";
+    bool        valid   = system(command.c_str()) == 0;
+    std::ifstream list("round_trip_list.tmp");
+    for (std::string line; std::getline(list, line);) {
+        size_t start = line.find_first_not_of(' ');
+        if (start == std::string::npos) continue;
+        size_t end = line.find("  ", start);
+        if (line.back() == '/' || end == std::string::npos) {
+            listed.push_back(line.substr(start));
+        } else {
+            listed.push_back(line.substr(line.find_first_not_of(' ', end)) + " " + line.substr(start, end - start));
+        }
+    }
+    remove("round_trip_list.tmp");
+    std::sort(expected.begin(), expected.end());
+    std::sort(listed.begin(), listed.end());
+    valid = valid && expected == listed;
+
+    std::cout << "List: " << input_path << " - " << (valid ? "ok" : "FAILED") << std::endl;
+    return valid;
+}
+
+// extract --verify must accept compressed_file, and must reject a copy with one bit flipped in the middle. Only
+// archives of 64KB or more are corrupted, smaller ones may have their header or index in the middle
+bool verify_check(const char* input_path, const char* compressed_file) {
+    std::string command = "./build/extract --verify \"" + std::string(compressed_file) + "\" > /dev/null";
+    bool        valid   = system(command.c_str()) == 0;
+
+    long size = get_file_size(compressed_file);
+    if (valid && size >= 64 * 1024) {
+        std::ifstream original(compressed_file, std::ios::binary);
+        std::vector<char> bytes((std::istreambuf_iterator<char>(original)), std::istreambuf_iterator<char>());
+        bytes[size / 2] ^= 0x10;
+        std::ofstream("round_trip_verify.tmp", std::ios::binary).write(bytes.data(), bytes.size());
+        valid = system("./build/extract --verify round_trip_verify.tmp > /dev/null") != 0;
+        remove("round_trip_verify.tmp");
+    }
+
+    std::cout << "Verify: " << input_path << " - " << (valid ? "ok" : "FAILED") << std::endl;
+    return valid;
+}
+
+// Compresses input_path with archive and archive_options and with modified_archive and modified_options (which may
+// start with OMP_NUM_THREADS=<N>), the archives must be identical, extract to the input and pass extract --verify.
+// With bounded, the archive may not be larger than the stored input either
+bool options_check(const char* input_path, const std::string& archive_options, const std::string& modified_options, bool bounded) {
+    const std::string input(input_path);
+    std::string       modified = modified_options;
+    std::string       prefix;
+    if (modified.compare(0, 16, "OMP_NUM_THREADS=") == 0) {
+        prefix   = modified.substr(0, modified.find(' ') + 1);
+        modified = modified.substr(prefix.size());
+    }
+    std::string command = "./build/archive --batch " + archive_options + " \"" + input + "\" > /dev/null && mv \"" + input +
+                          ".compressed\" round_trip_options.tmp && " + prefix + "./build/modified_archive --batch " + modified + " \"" +
+                          input + "\" > /dev/null && mv \"" + input + ".compressed\" round_trip_modified.tmp";
+    bool valid = system(command.c_str()) == 0 && compare_files("round_trip_options.tmp", "round_trip_modified.tmp") &&
+                 (!bounded || within_stored_size(input_path, get_file_size("round_trip_modified.tmp")));
+
+    std::cout << "Options (archive" << (archive_options.empty() ? "" : " ") << archive_options << ", modified_archive"
+              << (modified_options.empty() ? "" : " ") << modified_options << "): " << input_path << " - " << (valid ? "ok" : "FAILED")
+              << std::endl;
+    valid = round_trip(input_path, "round_trip_modified.tmp") && valid;
+    valid = verify_check(input_path, "round_trip_modified.tmp") && valid;
+    remove("round_trip_options.tmp");
+    remove("round_trip_modified.tmp");
+    return valid;
+}
+
+// Incompressible files are stored and no code is longer on average than a stored byte (see MAX_ARCHIVE_OVERHEAD)
+bool within_stored_size(const char* input_path, long compressed_size) {
+    long input_size = get_file_size(input_path);
+    long checksums  = 12 * (input_size / (1024 * 1024) + 1);   // and seek points
+    return compressed_size <= input_size + MAX_ARCHIVE_OVERHEAD + checksums + (long)strlen(input_path);
+}
+
+// Compresses input_path with both compressors and seek points, and compares parts of it read with extract --range
+// (at the start, across seek points and up to the end) with the same bytes of the input
+bool range_check(const char* input_path, const char* seek_option) {
+    const std::string input(input_path);
+    const long        size    = get_file_size(input_path);
+    std::string       command = std::string("./build/archive --batch ") + seek_option + " \"" + input + "\" > /dev/null && mv \"" + input +
+                          ".compressed\" round_trip_seek.tmp && ./build/modified_archive --batch " + seek_option + " \"" + input +
+                          "\" > /dev/null && mv \"" + input + ".compressed\" round_trip_output.tmp";
+    bool valid = system(command.c_str()) == 0 && compare_files("round_trip_seek.tmp", "round_trip_output.tmp");
+
+    std::ifstream file(input_path, std::ios::binary);
+    const long    ranges[][2] = {{0, 1}, {0, size / 2}, {size / 3 + 17, 100000}, {size / 2 - 1, size / 2 + 1}, {size - 1000, 1000}};
+    for (const auto& range : ranges) {
+        long offset = std::max(0L, std::min(range[0], size)), length = std::max(0L, std::min(range[1], size - offset));
+        command     = "./build/extract --range=" + std::to_string(offset) + ":" + std::to_string(length) + " round_trip_seek.tmp \"" + input +
+                  "\" > round_trip_output.tmp";
+        if (!valid || system(command.c_str()) != 0) {
+            valid = false;
+            break;
+        }
+        std::vector<char> bytes(length);
+        file.seekg(offset);
+        file.read(bytes.data(), length);
+        std::ifstream output("round_trip_output.tmp", std::ios::binary);
+        valid = std::equal(bytes.begin(), bytes.end(), std::istreambuf_iterator<char>(output), std::istreambuf_iterator<char>());
+    }
+    remove("round_trip_seek.tmp");
+    remove("round_trip_output.tmp");
+
+    std::cout << "Ranges (" << seek_option << "): " << input_path << " - " << (valid ? "ok" : "FAILED") << std::endl;
+    return valid;
+}
+
+// Compresses input_path through a pipe with archive, decompresses it with extract --stream and compares the result
+// with the input
+bool stream_round_trip(const char* input_path, const char* options) {
+    const std::string input(input_path);
+    std::string command = std::string("./build/archive ") + options + " < \"" + input + "\" > round_trip_stream.tmp && ./build/extract --stream" +
+                          " < round_trip_stream.tmp > round_trip_output.tmp";
+    bool        valid   = system(command.c_str()) == 0 && compare_files(input_path, "round_trip_output.tmp");
+    remove("round_trip_stream.tmp");
+    remove("round_trip_output.tmp");
+
+    std::cout << "Round trip (" << options << "): " << input_path << " - " << (valid ? "ok" : "FAILED") << std::endl;
+    return valid;
+}
+
+// extract must refuse archives whose paths lead out of the working folder before it writes anything. They are built
+// by hand from archives of harmless paths: the index path of one is replaced by "../evil.txt", of another by the
+// absolute path of the same file (the names are chosen with the same lengths), and an archive of "../evil.txt"
+// made from a subfolder loses its index, so the names of the records are checked instead
+bool unsafe_path_check() {
+    const std::string folder = "round_trip_unsafe.tmp";
+    char              cwd[4096];
+    if (!getcwd(cwd, sizeof(cwd))) return false;
+    const std::string target   = std::string(cwd) + "/" + folder + "/evil.txt";
+    const std::string relative = "zz/" + std::string(target.size() - 3, 'e');
+
+    system(("rm -rf " + folder + " && mkdir -p " + folder + "/zz " + folder + "/out").c_str());
+    for (const std::string& name : {std::string("zz/evil.txt"), relative, std::string("evil.txt")}) {
+        std::ofstream(folder + "/" + name) << "evil\n";
+    }
+    std::string command = "cd " + folder + " && ../build/archive --batch zz/evil.txt > /dev/null && ../build/archive --batch " + relative +
+                          " > /dev/null && cd zz && ../../build/archive --batch ../evil.txt > /dev/null";
+    bool valid = relative.size() < 255 && system(command.c_str()) == 0;
+    std::ofstream(folder + "/evil.txt") << "safe\n";
+
+    const std::string archives[][3] = {{"zz/evil.txt", "zz/evil.txt", "../evil.txt"},
+                                       {relative, relative, target},
+                                       {"evil.txt", "HUFINDEX", "XXXXXXXX"}};
+    for (const auto& archive : archives) {
+        std::ifstream     input(folder + "/" + archive[0] + ".compressed", std::ios::binary);
+        std::string       bytes((std::istreambuf_iterator<char>(input)), std::istreambuf_iterator<char>());
+        size_t            found = bytes.rfind(archive[1]);
+        if (!valid || found == std::string::npos) {
+            valid = false;
+            break;
+        }
+        bytes.replace(found, archive[1].size(), archive[2]);
+        std::ofstream(folder + "/unsafe.compressed", std::ios::binary) << bytes;
+
+        std::vector<std::string> written;
+        valid = system(("cd " + folder + "/out && ../../build/extract -n ../unsafe.compressed > /dev/null").c_str()) != 0;
+        list_paths(folder + "/out", written);
+        std::ifstream evil(folder + "/evil.txt");
+        std::string   content((std::istreambuf_iterator<char>(evil)), std::istreambuf_iterator<char>());
+        valid = valid && written.size() == 1 && content == "safe\n";
+    }
+    system(("rm -rf " + folder).c_str());
+
+    std::cout << "Unsafe paths: " << (valid ? "refused" : "FAILED") << std::endl;
+    return valid;
+}
+
+// Same files on every run: fixed seed
+void make_test_tree(const char* folder) {
+    const std::string root(folder);
+    system(("rm -rf \"" + root + "\"").c_str());
+    for (const char* sub : {"", "/sub", "/sub/deeper", "/empty_folder"}) {
+        mkdir((root + sub).c_str(), 0755);
+    }
+
+    std::mt19937 gen(2024);
+    std::ofstream(root + "/empty_file");
+    std::ofstream(root + "/sub/one_letter") << std::string(4096, 'a');
+
+    std::ofstream text(root + "/sub/text.txt");
+    for (int line = 0; line < 20000; line++) {
+        text << "line " << line << ": " << gen() % 1000 << " HelloWorldThisIsARepeatingPattern\n";
+    }
+
+    std::ofstream                   random(root + "/sub/deeper/random.bin", std::ios::binary);
+    std::uniform_int_distribution<> dis(0, 255);
+    for (int i = 0; i < (1 << 20); i++) {
+        random.put((char)dis(gen));
+    }
+
+    // Fields that take more than one varint byte: a path of more than 500 bytes and a folder of 300 entries
+    const std::string long_name = root + "/" + std::string(250, 'n');
+    mkdir(long_name.c_str(), 0755);
+    mkdir((long_name + "/" + std::string(250, 'm')).c_str(), 0755);
+    std::ofstream(long_name + "/" + std::string(250, 'm') + "/file.txt") << "long path\n";
+    mkdir((root + "/many_files").c_str(), 0755);
+    for (int i = 0; i < 300; i++) {
+        std::ofstream(root + "/many_files/" + std::to_string(i)) << std::string(i, (char)('a' + i % 26));
+    }
+}
+
 bool compare_files(const char* file1, const char* file2) {
     std::ifstream f1(file1, std::ios::binary);
     std::ifstream f2(file2, std::ios::binary);
@@ -154,7 +496,50 @@ bool compare_files(const char* file1, const char* file2) {
         return false;
     }
 
-    return std::equal(std::istreambuf_iterator<char>(f1), std::istreambuf_iterator<char>(), std::istreambuf_iterator<char>(f2));
+    return std::equal(std::istreambuf_iterator<char>(f1), std::istreambuf_iterator<char>(), std::istreambuf_iterator<char>(f2),
+                      std::istreambuf_iterator<char>());
+}
+
+// Files are compared byte by byte, folders must hold the same names and every one must compare equal
+bool compare_paths(const std::string& path1, const std::string& path2) {
+    struct stat status1, status2;
+    if (stat(path1.c_str(), &status1) || stat(path2.c_str(), &status2)) return false;
+    if (S_ISDIR(status1.st_mode) != S_ISDIR(status2.st_mode)) return false;
+    if (!S_ISDIR(status1.st_mode)) return compare_files(path1.c_str(), path2.c_str());
+
+    std::vector<std::string> names[2];
+    const std::string*       paths[2] = {&path1, &path2};
+    for (int k = 0; k < 2; k++) {
+        DIR* folder = opendir(paths[k]->c_str());
+        if (!folder) return false;
+        while (dirent* entry = readdir(folder)) {
+            if (strcmp(entry->d_name, ".") && strcmp(entry->d_name, "..")) names[k].push_back(entry->d_name);
+        }
+        closedir(folder);
+        std::sort(names[k].begin(), names[k].end());
+    }
+    if (names[0] != names[1]) return false;
+    for (const std::string& name : names[0]) {
+        if (!compare_paths(path1 + "/" + name, path2 + "/" + name)) return false;
+    }
+    return true;
+}
+
+// Adds "<path>/" for every folder and "<path> <size>" for every file of path, path included
+void list_paths(const std::string& path, std::vector<std::string>& entries) {
+    struct stat status;
+    if (stat(path.c_str(), &status)) return;
+    if (!S_ISDIR(status.st_mode)) {
+        entries.push_back(path + " " + std::to_string((long)status.st_size));
+        return;
+    }
+    entries.push_back(path + "/");
+    if (DIR* folder = opendir(path.c_str())) {
+        while (dirent* entry = readdir(folder)) {
+            if (strcmp(entry->d_name, ".") && strcmp(entry->d_name, "..")) list_paths(path + "/" + entry->d_name, entries);
+        }
+        closedir(folder);
+    }
 }
 
 std::string get_base_name(const char* file_path) {
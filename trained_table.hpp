@@ -0,0 +1,147 @@
+#pragma once
+
+#include "code_table.hpp"
+#include "histogram.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+// Trained translation tables (archive --train, --table).
+// Data with a stable byte distribution (logs, CSV exports) gets the same table run after run, so the table can be
+// built once from sample files and reused: the compressor then takes the code lengths from the table and skips
+// the counting pass, which halves the input read. The table is written into the compressed file as usual
+// (third part), so extract needs nothing else. Files are still sampled to find the ones the table would not make
+// smaller, which are stored (see stored_with_table).
+//
+// Trained tables give every one of the 256 bytes a transformation, bytes the samples do not contain get the
+// longest ones, so any input can be compressed with any table.
+//
+// table file
+//     1 (8 bytes)    ->  TABLE_MAGIC
+//     2 (one byte)   ->  TABLE_VERSION
+//     3 (256 bytes)  ->  length of the transformation of every byte (canonical, see code_table.hpp)
+
+const char          TABLE_MAGIC[8] = {'H', 'U', 'F', 'T', 'A', 'B', 'L', 'E'};
+const unsigned char TABLE_VERSION  = 1;
+
+// Built-in tables, built like train_table() does from generated samples ("text": log lines and English prose,
+// "csv": a comma separated export of dates, names and amounts), printable bytes were given a small minimum count
+constexpr unsigned char PRESET_TEXT[256] = {
+    12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 7, 12, 12, 12, 12, 12,
+    12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12,
+    3, 12, 12, 8, 12, 12, 12, 12, 7, 7, 8, 12, 7, 5, 6, 12,
+    5, 5, 5, 6, 5, 6, 6, 6, 6, 6, 5, 12, 12, 7, 12, 12,
+    12, 8, 12, 12, 8, 8, 12, 12, 12, 12, 12, 12, 12, 12, 8, 8,
+    12, 12, 7, 8, 12, 10, 12, 12, 12, 12, 12, 7, 12, 7, 12, 12,
+    7, 5, 7, 6, 5, 4, 7, 7, 7, 5, 12, 6, 6, 6, 6, 5,
+    6, 12, 5, 5, 5, 6, 8, 12, 12, 12, 12, 12, 12, 12, 12, 12,
+    12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12,
+    12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12,
+    12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12,
+    12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12,
+    12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12,
+    12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12,
+    12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12,
+    12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12
+};
+
+constexpr unsigned char PRESET_CSV[256] = {
+    12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 6, 12, 12, 12, 12, 12,
+    12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12,
+    12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 3, 5, 6, 12,
+    4, 4, 4, 5, 4, 5, 5, 5, 5, 5, 5, 12, 12, 12, 12, 12,
+    12, 7, 12, 12, 6, 6, 7, 7, 12, 6, 12, 7, 7, 12, 6, 7,
+    7, 12, 12, 12, 6, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12,
+    12, 5, 12, 7, 6, 5, 12, 12, 12, 6, 12, 12, 7, 12, 6, 6,
+    12, 12, 6, 11, 12, 12, 10, 12, 12, 12, 12, 12, 12, 12, 12, 12,
+    12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12,
+    12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12,
+    12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12,
+    12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12,
+    12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12,
+    12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12,
+    12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12,
+    12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12
+};
+
+struct table_preset {
+    const char*          id;
+    const unsigned char* lengths;
+};
+
+constexpr table_preset TABLE_PRESETS[] = {{"text", PRESET_TEXT}, {"csv", PRESET_CSV}};
+
+// Lengths of a trained table from the byte counts of the samples.
+// Every count is raised by one so bytes that did not occur still get a (long) transformation
+inline void train_table(const long int* number, unsigned char* lengths) {
+    long int smoothed[256];
+    for (int c = 0; c < 256; c++) {
+        smoothed[c] = number[c] + 1;
+    }
+    huffman_code_lengths(smoothed, lengths);
+    limit_code_lengths(lengths, smoothed, MAX_CODE_LENGTH);
+}
+
+// Every byte has a length and the lengths give a complete prefix free code (Kraft sum of exactly one), which is what
+// extract requires of the third part (read_code_lengths in Decompressor.cpp)
+inline bool valid_table(const unsigned char* lengths) {
+    uint32_t total = 0;
+    for (int c = 0; c < 256; c++) {
+        if (!lengths[c] || lengths[c] > MAX_CODE_LENGTH_LIMIT) return false;
+        total += 1u << (MAX_CODE_LENGTH_LIMIT - lengths[c]);
+    }
+    return total == 1u << MAX_CODE_LENGTH_LIMIT;
+}
+
+// Bytes counted by stored_with_table: TABLE_SAMPLE_BLOCKS blocks spread evenly over the file, smaller files whole
+const size_t TABLE_SAMPLE_BLOCK  = 4096;
+const size_t TABLE_SAMPLE_BLOCKS = 16;
+
+// With a trained table the contents are not counted, so the entropy test of the counting pass (STORED_ENTROPY in
+// histogram.hpp) cannot run. Instead a file is stored when its sampled bytes would not get shorter with the lengths
+// of the table: random or already compressed data, or a distribution the table was not trained for
+inline bool stored_with_table(const unsigned char* data, size_t size, const unsigned char* lengths) {
+    long int number[256] = {0};
+    size_t   sampled     = 0;
+    if (size <= TABLE_SAMPLE_BLOCK * TABLE_SAMPLE_BLOCKS) {
+        count_bytes(data, size, number);
+        sampled = size;
+    } else {
+        for (size_t k = 0; k < TABLE_SAMPLE_BLOCKS; k++) {
+            count_bytes(data + k * (size - TABLE_SAMPLE_BLOCK) / (TABLE_SAMPLE_BLOCKS - 1), TABLE_SAMPLE_BLOCK, number);
+            sampled += TABLE_SAMPLE_BLOCK;
+        }
+    }
+    uint64_t bits = 0;
+    for (int c = 0; c < 256; c++) {
+        bits += (uint64_t)number[c] * lengths[c];
+    }
+    return sampled && bits >= 8 * (uint64_t)sampled;
+}
+
+inline bool save_table(const std::string& path, const unsigned char* lengths) {
+    FILE* fp = fopen(path.c_str(), "wb");
+    if (!fp) return false;
+    fwrite(TABLE_MAGIC, 1, 8, fp);
+    fwrite(&TABLE_VERSION, 1, 1, fp);
+    fwrite(lengths, 1, 256, fp);
+    return fclose(fp) == 0;
+}
+
+// id is the name of a preset or the path of a table file, returns false if it is neither
+inline bool load_table(const std::string& id, unsigned char* lengths) {
+    for (const table_preset& preset : TABLE_PRESETS) {
+        if (id == preset.id) {
+            memcpy(lengths, preset.lengths, 256);
+            return true;
+        }
+    }
+    FILE* fp = fopen(id.c_str(), "rb");
+    if (!fp) return false;
+    char          magic[8];
+    unsigned char version = 0;
+    bool          read    = fread(magic, 1, 8, fp) == 8 && fread(&version, 1, 1, fp) == 1 && fread(lengths, 1, 256, fp) == 256;
+    fclose(fp);
+    return read && !memcmp(magic, TABLE_MAGIC, 8) && version == TABLE_VERSION && valid_table(lengths);
+}